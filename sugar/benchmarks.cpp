@@ -0,0 +1,811 @@
+#include "benchmarks.h"
+#include "cont_task_group.h"
+#include "compact_graph.h"
+#include "dag.h"
+#include "numa_arenas.h"
+#include "resource_graph.h"
+#include "workloads.h"
+
+#include <tbb/parallel_for.h>
+#include <tbb/cache_aligned_allocator.h>
+#include <tbb/tick_count.h>
+
+#include <iostream>
+#include <array>
+#include <vector>
+#include <string>
+#include <random>
+#include <atomic>
+#include <algorithm>
+
+// seconds it takes for all the workers to set num_conts conts ready, and for the one task that waits for all of them to run,
+// when the conts decrement the reference count of the task directly, or through a fan-in tree.
+static double TimeFanIn(int num_conts, bool fan_in)
+{
+    std::vector<cont<int>> conts(num_conts);
+    std::vector<cont_base*> inputs(num_conts);
+    std::vector<cont_node> nodes(num_conts);
+    std::vector<cont_fan_in, tbb::cache_aligned_allocator<cont_fan_in>> fan_ins(fan_in_tree_size(num_conts));
+    for (int i = 0; i < num_conts; i++)
+    {
+        inputs[i] = &conts[i];
+    }
+
+    tbb::empty_task& done = *new (tbb::task::allocate_root()) tbb::empty_task();
+    done.set_ref_count(2);
+    tbb::empty_task& consumer = *new (done.allocate_child()) tbb::empty_task();
+    if (fan_in)
+    {
+        spawn_when_ready(consumer, inputs.data(), nodes.data(), fan_ins.data(), num_conts);
+    }
+    else
+    {
+        spawn_when_ready(consumer, inputs.data(), nodes.data(), num_conts);
+    }
+
+    tbb::tick_count start = tbb::tick_count::now();
+
+    tbb::parallel_for(0, num_conts, [&](int i) {
+        conts[i].emplace(i);
+        conts[i].set_ready();
+    });
+    done.wait_for_all();
+
+    double seconds = (tbb::tick_count::now() - start).seconds();
+
+    tbb::task::destroy(done);
+    return seconds;
+}
+
+static void FanInBenchmark()
+{
+    for (int n : { 256, 4096, 65536 })
+    {
+        // the best of a few runs, since a single one is mostly noise.
+        double flat = 1e9, tree = 1e9;
+        for (int run = 0; run < 5; run++)
+        {
+            flat = std::min(flat, TimeFanIn(n, false));
+            tree = std::min(tree, TimeFanIn(n, true));
+        }
+        std::cout << "fan-in: " << n << " conts take " << flat * 1e3 << " ms directly, "
+                  << tree * 1e3 << " ms through a fan-in tree\n";
+    }
+}
+
+static void CompletionTrackingBenchmark()
+{
+    const int num_spawners = 100;
+    const int num_tasks = 1000;
+
+    for (completion_tracking tracking : { completion_tracking::root_ref_count, completion_tracking::distributed })
+    {
+        std::atomic<int> ran(0);
+
+        // lots of tiny tasks, run from all the workers at once, all counted by the same group.
+        tbb::tick_count start = tbb::tick_count::now();
+        cont_task_group g(tracking);
+        for (int s = 0; s < num_spawners; s++)
+        {
+            g.run([&] {
+                for (int i = 0; i < num_tasks; i++)
+                {
+                    g.run([&] { ran.fetch_add(1, std::memory_order_relaxed); });
+                }
+            });
+        }
+        g.wait();
+        double seconds = (tbb::tick_count::now() - start).seconds();
+
+        std::cout << "completion tracking: " << ran.load() << " tasks in " << seconds * 1e3 << " ms, counted "
+                  << (tracking == completion_tracking::distributed ? "by a completion_counter" : "by the root's reference count") << "\n";
+    }
+}
+
+static void RunRangeBenchmark()
+{
+    const int n = 100000;
+    std::vector<int> squares(n);
+    cont_task_group g;
+
+    // the same small tasks, run one by one, and as a single range.
+    tbb::tick_count start = tbb::tick_count::now();
+    for (int i = 0; i < n; i++)
+    {
+        g.run([&squares, i] { squares[i] = i * i; });
+    }
+    g.wait();
+    double one_by_one = (tbb::tick_count::now() - start).seconds();
+
+    start = tbb::tick_count::now();
+    g.run_range(0, n, [&squares](int i) { squares[i] = i * i; });
+    g.wait();
+    double as_range = (tbb::tick_count::now() - start).seconds();
+
+    std::cout << "run_range: " << n << " tasks take " << one_by_one * 1e3 << " ms run one by one, "
+              << as_range * 1e3 << " ms as a range\n";
+}
+
+static void GraphReplayBenchmark()
+{
+    const int num_parts = 64;
+    const int num_frames = 1000;
+
+    std::vector<cont<int>> parts(num_parts);
+    std::vector<cont_base*> inputs(num_parts);
+    for (int i = 0; i < num_parts; i++)
+    {
+        inputs[i] = &parts[i];
+    }
+    cont<long long> total;
+    int frame = 0;
+    cont_task_group g;
+
+    // every frame run through the group again.
+    tbb::tick_count start = tbb::tick_count::now();
+    for (frame = 0; frame < num_frames; frame++)
+    {
+        AddFrameTasks(g, frame, parts, inputs, total);
+        g.wait();
+
+        for (cont<int>& part : parts)
+        {
+            part.reset();
+        }
+        total.reset();
+    }
+    double rebuilt = (tbb::tick_count::now() - start).seconds();
+
+    // captured once, and replayed for every frame.
+    cont_graph graph;
+    g.begin_capture(graph);
+    AddFrameTasks(g, frame, parts, inputs, total);
+    g.capture_output(total);
+    g.end_capture();
+
+    start = tbb::tick_count::now();
+    for (frame = 0; frame < num_frames; frame++)
+    {
+        graph.replay();
+    }
+    double replayed = (tbb::tick_count::now() - start).seconds();
+
+    std::cout << "graph replay: " << num_frames << " frames of " << num_parts + 1 << " tasks take " << rebuilt * 1e3 << " ms run through the group, "
+              << replayed * 1e3 << " ms replayed\n";
+}
+
+static void DagBenchmark()
+{
+    const int num_runs = 10000;
+    int x = 0, left = 0, right = 0, sum = 0;
+
+    auto source = [&x] { x++; };
+    auto left_fun = [&x, &left] { left = x * 2; };
+    auto right_fun = [&x, &right] { right = x * 3; };
+    auto sink = [&left, &right, &sum] { sum = left + right; };
+
+    typedef dag<node<decltype(source)>,
+                node<decltype(left_fun), deps<decltype(source)>>,
+                node<decltype(right_fun), deps<decltype(source)>>,
+                node<decltype(sink), deps<decltype(left_fun), decltype(right_fun)>>> diamond;
+    diamond d(source, left_fun, right_fun, sink);
+
+    tbb::tick_count start = tbb::tick_count::now();
+    for (int i = 0; i < num_runs; i++)
+    {
+        d.run();
+    }
+    double static_time = (tbb::tick_count::now() - start).seconds();
+
+    // the same diamond, registered through conts every time.
+    cont_task_group g;
+    start = tbb::tick_count::now();
+    for (int i = 0; i < num_runs; i++)
+    {
+        cont<int> a, b, c;
+        g.run([&] { source(); a.set_ready(); });
+        g.with(a).run([&] { left_fun(); b.set_ready(); });
+        g.with(a).run([&] { right_fun(); c.set_ready(); });
+        g.with(b, c).run(sink);
+        g.wait();
+    }
+    double dynamic_time = (tbb::tick_count::now() - start).seconds();
+
+    std::cout << "dag: " << num_runs << " runs of a diamond take " << static_time * 1e3 << " ms as a dag, " << dynamic_time * 1e3
+              << " ms through conts\n";
+}
+
+static void CompactGraphBenchmark()
+{
+    const int width = 1000;
+    const int depth = 100;
+    const int num_frames = 10;
+
+    std::vector<cont<int>> values(width * depth);
+    cont_task_group g;
+    cont_graph graph;
+    g.begin_capture(graph);
+    AddLayeredTasks(g, values, width, depth);
+    g.end_capture();
+
+    tbb::tick_count start = tbb::tick_count::now();
+    for (int frame = 0; frame < num_frames; frame++)
+    {
+        graph.replay();
+    }
+    double linked = (tbb::tick_count::now() - start).seconds();
+
+    // the same graph, with indices and arrays instead of nodes linked into the conts.
+    compact_graph compact(graph);
+    start = tbb::tick_count::now();
+    for (int frame = 0; frame < num_frames; frame++)
+    {
+        compact.replay();
+    }
+    double compacted = (tbb::tick_count::now() - start).seconds();
+
+    std::cout << "compact graph: " << num_frames << " replays of " << width * depth << " tasks take " << linked * 1e3 << " ms linked, "
+              << compacted * 1e3 << " ms compact\n";
+}
+
+static void StaticScheduleBenchmark()
+{
+    const int width = 256;
+    const int depth = 32;
+    const int num_frames = 100;
+
+    std::vector<cont<int>> values(width * depth);
+    cont_task_group g;
+    cont_graph graph;
+    g.begin_capture(graph);
+    AddLayeredTasks(g, values, width, depth);
+    g.end_capture();
+
+    compact_graph compact(graph);
+    compact.replay_and_measure();
+
+    tbb::tick_count start = tbb::tick_count::now();
+    for (int frame = 0; frame < num_frames; frame++)
+    {
+        compact.replay();
+    }
+    double dynamic_time = (tbb::tick_count::now() - start).seconds();
+
+    compact.build_static_schedule();
+    start = tbb::tick_count::now();
+    for (int frame = 0; frame < num_frames; frame++)
+    {
+        compact.replay();
+    }
+    double static_time = (tbb::tick_count::now() - start).seconds();
+
+    std::cout << "static schedule: " << num_frames << " replays of " << width * depth << " tasks take "
+              << dynamic_time * 1e3 << " ms dynamic, " << static_time * 1e3 << " ms static\n";
+}
+
+static void PrioritiesBenchmark()
+{
+    const int chain_length = 32;
+    const int num_short = 512;
+    const int num_frames = 20;
+
+    // a long chain of tasks, and many short tasks that become ready at the same time as the first link of the chain.
+    // the chain is the critical path, so the frame is over sooner if its links run before the short tasks.
+    cont<int> start_cont;
+    std::vector<cont<int>> chain(chain_length);
+    cont_task_group g;
+    cont_graph graph;
+    g.begin_capture(graph);
+    g.run([&start_cont] { start_cont.emplace(0); start_cont.set_ready(); });
+    for (int i = 0; i < num_short; i++)
+    {
+        g.with(start_cont).run([] { SpinFor(20); });
+    }
+    for (int i = 0; i < chain_length; i++)
+    {
+        cont<int>& in = i == 0 ? start_cont : chain[i - 1];
+        cont<int>& out = chain[i];
+        g.with(in).run([&in, &out] {
+            SpinFor(50);
+            out.emplace(*in + 1);
+            out.set_ready();
+        });
+    }
+    g.capture_output(chain.back());
+    g.end_capture();
+
+    compact_graph compact(graph);
+    compact.replay_and_measure();
+
+    tbb::tick_count start = tbb::tick_count::now();
+    for (int frame = 0; frame < num_frames; frame++)
+    {
+        compact.replay();
+    }
+    double unordered = (tbb::tick_count::now() - start).seconds();
+
+    compact.build_priorities();
+    start = tbb::tick_count::now();
+    for (int frame = 0; frame < num_frames; frame++)
+    {
+        compact.replay();
+    }
+    double prioritized = (tbb::tick_count::now() - start).seconds();
+
+    std::cout << "priorities: a frame takes " << unordered / num_frames * 1e3 << " ms in registration order, " << prioritized / num_frames * 1e3
+              << " ms with the critical path first\n";
+}
+
+// how long after set_ready() the first registered consumer of a cont with many consumers starts, on average,
+// and how long the slowest consumer waits, in microseconds.
+static void TimeNotifyOrder(notify_order order, int num_consumers, int num_trials, double& first_latency, double& last_latency)
+{
+    std::vector<tbb::tick_count> started(num_consumers);
+    first_latency = 0.0;
+    last_latency = 0.0;
+
+    for (int trial = 0; trial < num_trials; trial++)
+    {
+        cont<int> c;
+        cont_task_group g;
+        for (int i = 0; i < num_consumers; i++)
+        {
+            g.with(c).run([&started, i] {
+                started[i] = tbb::tick_count::now();
+                SpinFor(5);
+            });
+        }
+
+        tbb::tick_count ready = tbb::tick_count::now();
+        c.emplace(trial);
+        c.set_ready(order);
+        g.wait();
+
+        double slowest = 0.0;
+        for (tbb::tick_count& t : started)
+        {
+            slowest = std::max(slowest, (t - ready).seconds());
+        }
+        first_latency += (started[0] - ready).seconds() * 1e6 / num_trials;
+        last_latency += slowest * 1e6 / num_trials;
+    }
+}
+
+static void NotifyOrderBenchmark()
+{
+    const int num_consumers = 64;
+    const int num_trials = 200;
+
+    double lifo_first, lifo_last, fifo_first, fifo_last;
+    TimeNotifyOrder(notify_order::last_registered_first, num_consumers, num_trials, lifo_first, lifo_last);
+    TimeNotifyOrder(notify_order::first_registered_first, num_consumers, num_trials, fifo_first, fifo_last);
+
+    std::cout << "notify order: the first of " << num_consumers << " consumers starts " << lifo_first << " us after set_ready last registered first, "
+              << fifo_first << " us first registered first. the last one starts after " << lifo_last << " us and " << fifo_last << " us\n";
+}
+
+// producers that each fill a large buffer, and consumers that read it back, with the given affinity mode on the conts in between.
+// returns the time it takes, in ms.
+static double TimeProducerAffinity(cont_affinity affinity, int num_pairs, int buffer_size, int num_rounds)
+{
+    std::vector<std::vector<int>> buffers(num_pairs, std::vector<int>(buffer_size));
+
+    tbb::tick_count start = tbb::tick_count::now();
+    for (int round = 0; round < num_rounds; round++)
+    {
+        std::vector<cont<int>> filled(num_pairs);
+        std::vector<long long> sums(num_pairs);
+        cont_task_group g;
+
+        for (int i = 0; i < num_pairs; i++)
+        {
+            filled[i].set_affinity_mode(affinity);
+            g.with(filled[i]).run([&buffers, &sums, i] {
+                long long sum = 0;
+                for (int x : buffers[i])
+                {
+                    sum += x;
+                }
+                sums[i] = sum;
+            });
+        }
+
+        for (int i = 0; i < num_pairs; i++)
+        {
+            g.run([&buffers, &filled, i, round] {
+                for (size_t j = 0; j < buffers[i].size(); j++)
+                {
+                    buffers[i][j] = (int)j + round;
+                }
+                filled[i].emplace(i);
+                filled[i].set_ready();
+            });
+        }
+
+        g.wait();
+    }
+    return (tbb::tick_count::now() - start).seconds() * 1e3;
+}
+
+static void ProducerAffinityBenchmark()
+{
+    // every buffer is 256KB, which fits in the L2 cache of the core that wrote it, but not in all of them at once.
+    const int num_pairs = 64;
+    const int buffer_size = 64 * 1024;
+    const int num_rounds = 20;
+
+    double anywhere = TimeProducerAffinity(cont_affinity::none, num_pairs, buffer_size, num_rounds);
+    double producer = TimeProducerAffinity(cont_affinity::producer, num_pairs, buffer_size, num_rounds);
+
+    std::cout << "producer affinity: " << num_rounds << " rounds of " << num_pairs << " producers and consumers of 256KB take " << anywhere
+              << " ms with the consumers spawned anywhere, " << producer << " ms with the producer's affinity\n";
+}
+
+// replays a graph of independent tasks that each update a large buffer of their own, and returns how long that takes, in ms.
+static double TimeAffinityMemory(bool enabled, int num_tasks, int buffer_size, int num_frames)
+{
+    std::vector<std::vector<int>> buffers(num_tasks, std::vector<int>(buffer_size));
+    cont_task_group g;
+    cont_graph graph;
+    g.begin_capture(graph);
+    for (int i = 0; i < num_tasks; i++)
+    {
+        g.run([&buffers, i] {
+            for (int& x : buffers[i])
+            {
+                x++;
+            }
+        });
+    }
+    g.end_capture();
+    graph.set_affinity_memory(enabled);
+
+    tbb::tick_count start = tbb::tick_count::now();
+    for (int frame = 0; frame < num_frames; frame++)
+    {
+        graph.replay();
+    }
+    return (tbb::tick_count::now() - start).seconds() * 1e3;
+}
+
+static void AffinityMemoryBenchmark()
+{
+    const int num_tasks = 64;
+    const int buffer_size = 64 * 1024;
+    const int num_frames = 50;
+
+    double forgetful = TimeAffinityMemory(false, num_tasks, buffer_size, num_frames);
+    double remembered = TimeAffinityMemory(true, num_tasks, buffer_size, num_frames);
+
+    std::cout << "affinity memory: " << num_frames << " replays of " << num_tasks << " tasks on 256KB each take " << forgetful
+              << " ms spawned anywhere, " << remembered << " ms where they ran the frame before\n";
+}
+
+static void NumaPinningBenchmark()
+{
+    const int num_tasks = 64;
+
+    numa_arenas arenas;
+    cont_task_group g;
+
+    // the workers of the arena of a node may only run on the CPUs of the node.
+    std::atomic<int> widest_in_node(0);
+    for (int node = 0; node < arenas.num_nodes(); node++)
+    {
+        for (int i = 0; i < num_tasks; i++)
+        {
+            g.run_in(arenas.arena(node), [&widest_in_node] {
+                RecordMax(widest_in_node, AllowedCpuCount());
+                SpinFor(10);
+            });
+        }
+        g.wait();
+    }
+
+    // once they're back in the default arena, they may run anywhere again.
+    std::atomic<int> widest_outside(0);
+    for (int i = 0; i < num_tasks; i++)
+    {
+        g.run([&widest_outside] {
+            RecordMax(widest_outside, AllowedCpuCount());
+            SpinFor(10);
+        });
+    }
+    g.wait();
+
+    std::cout << "numa pinning: " << arenas.num_nodes() << " nodes, threads run on up to " << widest_in_node << " CPUs in the arena of a node, "
+              << widest_outside << " CPUs in the default arena\n";
+}
+
+// registers consumers of a cont from the current thread, and sets the cont ready from the given arena (or from here, if NULL).
+// returns how long that takes, in ms, and counts the consumers that ran in the given arena.
+static double TimeArenaRelease(tbb::task_arena* producer_arena, tbb::task_arena* consumer_arena, int num_consumers, int num_rounds, int& ran_at_home)
+{
+    std::atomic<int> at_home(0);
+    cont_task_group g;
+
+    tbb::tick_count start = tbb::tick_count::now();
+    for (int round = 0; round < num_rounds; round++)
+    {
+        cont<int> c;
+        for (int i = 0; i < num_consumers; i++)
+        {
+            g.with(c).run([&at_home, consumer_arena] {
+                if (current_arena() == consumer_arena)
+                {
+                    at_home++;
+                }
+            });
+        }
+
+        auto produce = [&c, round] {
+            c.emplace(round);
+            c.set_ready();
+        };
+        if (producer_arena != NULL)
+        {
+            g.run_in(*producer_arena, produce);
+        }
+        else
+        {
+            g.run(produce);
+        }
+        g.wait();
+    }
+    double time = (tbb::tick_count::now() - start).seconds() * 1e3;
+
+    ran_at_home = at_home;
+    return time;
+}
+
+static void ArenaReleaseBenchmark()
+{
+    const int num_consumers = 16;
+    const int num_rounds = 1000;
+
+    // the consumers are registered from the default arena, and the producer runs in an arena of its own, with a single thread.
+    default_arena_tracker home;
+    tbb::task_arena other(1);
+    other.initialize();
+    arena_tracker other_tracker(other);
+
+    int same_at_home = 0, cross_at_home = 0;
+    double same = TimeArenaRelease(NULL, &home.arena(), num_consumers, num_rounds, same_at_home);
+    double cross = TimeArenaRelease(&other, &home.arena(), num_consumers, num_rounds, cross_at_home);
+
+    std::cout << "arena release: " << num_rounds << " rounds of " << num_consumers << " consumers take " << same << " ms released in their own arena, "
+              << cross << " ms released from another arena. " << cross_at_home << " of " << num_consumers * num_rounds
+              << " consumers released from the other arena ran in their own\n";
+}
+
+// runs frames of tasks with closures of the given number of ints, with or without a pool, and returns how long that takes, in ms.
+template<int PayloadSize>
+static double TimeGraphPool(graph_pool* pool, int num_tasks, int num_frames)
+{
+    std::atomic<long long> sum(0);
+
+    tbb::tick_count start = tbb::tick_count::now();
+    for (int frame = 0; frame < num_frames; frame++)
+    {
+        cont_task_group g;
+        g.use_pool(pool);
+        for (int i = 0; i < num_tasks; i++)
+        {
+            std::array<int, PayloadSize> payload;
+            payload.fill(i);
+            g.run([&sum, payload] { sum += payload[0] + payload[PayloadSize - 1]; });
+        }
+        g.wait();
+
+        if (pool != NULL)
+        {
+            pool->clear();
+        }
+    }
+    return (tbb::tick_count::now() - start).seconds() * 1e3;
+}
+
+static void GraphPoolBenchmark()
+{
+    const int num_tasks = 10000;
+    const int num_frames = 20;
+
+    // the big closures make tasks too big for TBB to recycle, so they're put in the pool. the small ones stay in their tasks either way.
+    graph_pool pool;
+    double heap = TimeGraphPool<64>(NULL, num_tasks, num_frames);
+    double pooled = TimeGraphPool<64>(&pool, num_tasks, num_frames);
+    double small_heap = TimeGraphPool<4>(NULL, num_tasks, num_frames);
+    double small_pooled = TimeGraphPool<4>(&pool, num_tasks, num_frames);
+
+    std::cout << "graph pool: " << num_frames << " frames of " << num_tasks << " tasks with 256 byte closures take " << heap
+              << " ms with the closures in the tasks, " << pooled << " ms with the closures in a pool. with 16 byte closures, "
+              << small_heap << " ms without a pool, " << small_pooled << " ms with one\n";
+}
+
+// pipelines of tasks that each make a cont on the heap for the next one, which frees it, often on another thread.
+// returns how long that takes, in ms.
+static double TimeHeapConts(slab_allocator* slabs, int num_chains, int chain_length)
+{
+    cont_task_group g;
+
+    tbb::tick_count start = tbb::tick_count::now();
+    for (int chain = 0; chain < num_chains; chain++)
+    {
+        g.run([&g, slabs, chain, chain_length] {
+            cont<int>* c = slabs != NULL ? slabs->make_cont<int>() : new cont<int>();
+            c->emplace(chain);
+            c->set_ready();
+            for (int i = 0; i < chain_length; i++)
+            {
+                cont<int>* next = slabs != NULL ? slabs->make_cont<int>() : new cont<int>();
+                g.with(*c).run([slabs, c, next] {
+                    next->emplace(**c + 1);
+                    if (slabs != NULL)
+                    {
+                        slabs->destroy(c);
+                    }
+                    else
+                    {
+                        delete c;
+                    }
+                    next->set_ready();
+                });
+                c = next;
+            }
+            g.with(*c).run([slabs, c] {
+                if (slabs != NULL)
+                {
+                    slabs->destroy(c);
+                }
+                else
+                {
+                    delete c;
+                }
+            });
+        });
+    }
+    g.wait();
+    return (tbb::tick_count::now() - start).seconds() * 1e3;
+}
+
+static void SlabAllocatorBenchmark()
+{
+    const int num_chains = 1000;
+    const int chain_length = 100;
+
+    slab_allocator slabs;
+    double heap = TimeHeapConts(NULL, num_chains, chain_length);
+    double slab = TimeHeapConts(&slabs, num_chains, chain_length);
+
+    std::cout << "slab allocator: " << num_chains * (chain_length + 1) << " heap conts take " << heap << " ms with new and delete, " << slab
+              << " ms from the slabs\n";
+}
+
+// how much memory the transient buffers of a frame of image passes take with and without aliasing.
+// every pass reads two buffers of the previous layer and writes one.
+static void AliasStorageBenchmark()
+{
+    const int width = 8;
+    const int depth = 16;
+    typedef std::array<float, 4096> buffer;
+
+    std::vector<transient_cont<buffer>> buffers(width * depth);
+    cont_task_group g;
+    cont_graph graph;
+    g.begin_capture(graph);
+    for (int layer = 0; layer < depth; layer++)
+    {
+        for (int i = 0; i < width; i++)
+        {
+            transient_cont<buffer>& out = buffers[layer * width + i];
+            if (layer == 0)
+            {
+                g.run([&out, i] {
+                    out.emplace();
+                    out->fill((float)i);
+                    out.set_ready();
+                });
+                continue;
+            }
+
+            transient_cont<buffer>& a = buffers[(layer - 1) * width + i];
+            transient_cont<buffer>& b = buffers[(layer - 1) * width + (i + 1) % width];
+            if (layer == depth - 1)
+            {
+                g.with(a, b).run([&a, &b] { (void)((*a)[0] + (*b)[0]); });
+                continue;
+            }
+
+            g.with(a, b).run([&out, &a, &b] {
+                out.emplace();
+                for (size_t k = 0; k < out->size(); k++)
+                {
+                    (*out)[k] = (*a)[k] * 0.5f + (*b)[k] * 0.25f + 1.0f;
+                }
+                out.set_ready();
+            });
+        }
+    }
+    g.end_capture();
+    g.wait();
+
+    compact_graph compact(graph);
+    compact.replay_and_measure();
+
+    std::vector<transient_cont_base*> transients;
+    for (int i = 0; i < width * (depth - 1); i++)
+    {
+        transients.push_back(&buffers[i]);
+    }
+    size_t aliased = compact.alias_storage(transients.data(), (int)transients.size());
+
+    std::cout << "alias storage: " << transients.size() << " buffers of " << sizeof(buffer) << " bytes take " << transients.size() * sizeof(buffer)
+              << " bytes on their own, " << aliased << " bytes aliased\n";
+}
+
+// frames of tasks that update random resources from other ones, to time how long the graph takes to infer their dependencies.
+static void ResourceGraphBenchmark()
+{
+    const int num_resources = 200;
+    const int num_tasks = 50000;
+    const int num_frames = 4;
+
+    resource_graph graph;
+    std::vector<resource_graph::resource> resources;
+    for (int i = 0; i < num_resources; i++)
+    {
+        resources.push_back(graph.named("buffer " + std::to_string(i)));
+    }
+
+    double declared = 0.0, ran = 0.0;
+    for (int frame = 0; frame < num_frames; frame++)
+    {
+        std::vector<long long> values(num_resources, 0);
+        std::mt19937 random(frame);
+
+        tbb::tick_count start = tbb::tick_count::now();
+        for (int t = 0; t < num_tasks; t++)
+        {
+            int a = (int)(random() % num_resources);
+            int w = (int)(random() % num_resources);
+            if (random() % 2 == 0)
+            {
+                graph.run({ resources[a], resources[w] }, { resources[w] }, [&values, a, w, t] { values[w] = values[w] * 7 + values[a] + t; });
+            }
+            else
+            {
+                graph.run({ resources[a] }, { resources[w] }, [&values, a, w, t] { values[w] = values[a] + t; });
+            }
+        }
+        tbb::tick_count declared_at = tbb::tick_count::now();
+        graph.wait();
+        tbb::tick_count done_at = tbb::tick_count::now();
+
+        declared += (declared_at - start).seconds();
+        ran += (done_at - declared_at).seconds();
+    }
+
+    std::cout << "resource graph: frames of " << num_tasks << " tasks over " << num_resources << " resources take " << declared * 1e3 / num_frames
+              << " ms to declare and " << ran * 1e3 / num_frames << " ms more to finish\n";
+}
+
+void RunBenchmarks()
+{
+    FanInBenchmark();
+    CompletionTrackingBenchmark();
+    RunRangeBenchmark();
+    GraphReplayBenchmark();
+    DagBenchmark();
+    CompactGraphBenchmark();
+    StaticScheduleBenchmark();
+    PrioritiesBenchmark();
+    NotifyOrderBenchmark();
+    ProducerAffinityBenchmark();
+    AffinityMemoryBenchmark();
+    NumaPinningBenchmark();
+    ArenaReleaseBenchmark();
+    GraphPoolBenchmark();
+    SlabAllocatorBenchmark();
+    AliasStorageBenchmark();
+    ResourceGraphBenchmark();
+}
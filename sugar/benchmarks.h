@@ -0,0 +1,6 @@
+// benchmarks that time the features of the conts that are about performance against the plain way of doing the same thing.
+
+#pragma once
+
+// runs all the benchmarks, and prints their times.
+void RunBenchmarks();
@@ -0,0 +1,1223 @@
+#include "checks.h"
+#include "cont_task_group.h"
+#include "compact_graph.h"
+#include "dag.h"
+#include "numa_arenas.h"
+#include "resource_graph.h"
+#include "cont_loop.h"
+#include "task_block.h"
+#include "workloads.h"
+
+#include <tbb/parallel_for.h>
+
+#include <iostream>
+#include <memory>
+#include <array>
+#include <vector>
+#include <string>
+#include <random>
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+
+static int num_checks = 0;
+static int num_failed = 0;
+
+// counts a check, and reports it if it failed.
+static void Check(bool ok, const char* what)
+{
+    num_checks++;
+    if (!ok)
+    {
+        num_failed++;
+        std::cout << "check failed: " << what << "\n";
+    }
+}
+
+static void CheckFanIn()
+{
+    const int num_conts = 10000;
+    std::vector<cont<int>> conts(num_conts);
+    std::vector<cont_base*> inputs(num_conts);
+    for (int i = 0; i < num_conts; i++)
+    {
+        inputs[i] = &conts[i];
+    }
+
+    long long sum = 0;
+    bool ran_without_conts = false;
+
+    cont_task_group g;
+    g.with_all(inputs.data(), num_conts).run([&] {
+        for (int i = 0; i < num_conts; i++)
+        {
+            sum += *conts[i];
+        }
+    });
+    tbb::parallel_for(0, num_conts, [&](int i) {
+        conts[i].emplace(i);
+        conts[i].set_ready();
+    });
+    // a task that waits for no conts at all runs right away.
+    g.with().run([&] { ran_without_conts = true; });
+    g.wait();
+
+    Check(sum == (long long)num_conts * (num_conts - 1) / 2, "fan-in: the task sees all its conts");
+    Check(ran_without_conts, "fan-in: a task without conts runs");
+}
+
+static void CheckCompletionTracking()
+{
+    const int num_spawners = 100;
+    const int num_tasks = 100;
+
+    for (completion_tracking tracking : { completion_tracking::root_ref_count, completion_tracking::distributed })
+    {
+        std::atomic<int> ran(0);
+
+        // tasks run from all the workers at once, all counted by the same group.
+        cont_task_group g(tracking);
+        for (int s = 0; s < num_spawners; s++)
+        {
+            g.run([&] {
+                for (int i = 0; i < num_tasks; i++)
+                {
+                    g.run([&] { ran.fetch_add(1, std::memory_order_relaxed); });
+                }
+            });
+        }
+        g.wait();
+
+        Check(ran == num_spawners * num_tasks, tracking == completion_tracking::distributed
+            ? "completion tracking: wait() waits for all the tasks counted by a completion_counter"
+            : "completion tracking: wait() waits for all the tasks counted by the root's reference count");
+    }
+}
+
+static void CheckCompletion()
+{
+    std::atomic<int> produced(0);
+    int seen = -1;
+
+    // the consumers wait for all the producers without blocking a thread, and see everything they did.
+    cont_task_group producers;
+    cont_task_group consumers;
+    producers.run_range(0, 1000, [&](int) { produced.fetch_add(1); });
+    consumers.with(producers.completion()).run([&] { seen = produced.load(); });
+    consumers.wait();
+    producers.wait();
+    Check(seen == 1000, "completion: the consumer sees all the tasks of the group");
+
+    // a cancelled group prunes its completion instead of setting it ready, so its consumers still run, and can tell.
+    cont_task_group cancelled;
+    cancelled.run([] {});
+    cancelled.cancel();
+    cont_base& cancelled_completion = cancelled.completion();
+    bool pruned = false;
+    consumers.with(cancelled_completion).run([&] { pruned = cancelled_completion.is_pruned(); });
+    consumers.wait();
+    cancelled.wait();
+    Check(pruned, "completion: the completion of a cancelled group is pruned");
+
+    // run_and_wait() hands the exceptions of its function over to wait(), like it does for the tasks of the group.
+    std::string message;
+    cont_task_group throwing;
+    try
+    {
+        throwing.run_and_wait([] { throw std::runtime_error("thrown by run_and_wait"); });
+    }
+    catch (const std::exception& e)
+    {
+        message = e.what();
+    }
+    Check(message == "thrown by run_and_wait", "completion: run_and_wait() rethrows the exception of its function");
+}
+
+static void CheckRunRange()
+{
+    const int n = 10000;
+    std::vector<int> squares(n);
+    cont_task_group g;
+    g.run_range(0, n, [&squares](int i) { squares[i] = i * i; });
+    g.wait();
+
+    bool all_squared = true;
+    for (int i = 0; i < n; i++)
+    {
+        all_squared = all_squared && squares[i] == i * i;
+    }
+    Check(all_squared, "run_range: every index runs once");
+
+    // with a cont for the result of every index, which the consumers can wait for one by one.
+    const int num_outs = 1000;
+    std::vector<cont<int>> outs(num_outs);
+    int last = 0;
+    g.run_range(0, num_outs, [](int i) { return 2 * i; }, outs.data());
+    g.with(outs[num_outs - 1]).run([&] { last = *outs[num_outs - 1]; });
+    g.wait();
+
+    bool all_set = true;
+    for (int i = 0; i < num_outs; i++)
+    {
+        all_set = all_set && outs[i].is_ready() && *outs[i] == 2 * i;
+    }
+    Check(all_set && last == 2 * (num_outs - 1), "run_range: every output cont gets the result of its index");
+}
+
+// the same features through a task_block, which define_root_task_block waits for.
+static void CheckTaskBlock()
+{
+    const int num_tasks = 1000;
+    const int num_outs = 100;
+
+    for (completion_tracking tracking : { completion_tracking::root_ref_count, completion_tracking::distributed })
+    {
+        std::atomic<int> ran(0);
+        cont<int> c;
+        std::vector<cont<int>> outs(num_outs);
+        int seen = 0, last = 0;
+
+        define_root_task_block([&](task_block& tb) {
+            for (int i = 0; i < num_tasks; i++)
+            {
+                tb.run([&] { ran++; });
+            }
+            tb.run_range(0, num_tasks, [&](int) { ran++; });
+            tb.run_range(0, num_outs, [](int i) { return 2 * i; }, outs.data());
+            tb.with(c).run([&] { seen = *c; });
+            tb.with(outs[num_outs - 1]).run([&] { last = *outs[num_outs - 1]; });
+            tb.run([&] { c.emplace(42); c.set_ready(); });
+        }, tracking);
+
+        Check(ran == 2 * num_tasks && seen == 42 && last == 2 * (num_outs - 1), tracking == completion_tracking::distributed
+            ? "task block: the block waits for all its tasks, counted by a completion_counter"
+            : "task block: the block waits for all its tasks, counted by the reference count of its task");
+    }
+}
+
+// blocks whose waiting is left to a continuation, from the tasks of a group, which waits for the continuations too.
+static void CheckTaskBlockThen()
+{
+    for (completion_tracking tracking : { completion_tracking::root_ref_count, completion_tracking::distributed })
+    {
+        std::atomic<int> ran(0);
+        std::atomic<int> num_early(0);
+        cont_task_group g(tracking);
+        for (int i = 0; i < 10; i++)
+        {
+            g.run([&ran, &num_early] {
+                define_task_block_then([&ran](task_block& tb) {
+                    for (int j = 0; j < 100; j++)
+                    {
+                        tb.run([&ran] { ran++; });
+                    }
+                }, [&ran, &num_early] {
+                    // at least the tasks of its own block have run.
+                    if (ran < 100)
+                    {
+                        num_early++;
+                    }
+                });
+            });
+        }
+        g.wait();
+
+        Check(ran == 1000 && num_early == 0, tracking == completion_tracking::distributed
+            ? "task block then: the group waits for the continuations, counted by a completion_counter"
+            : "task block then: the group waits for the continuations, counted by the reference count of the group");
+    }
+
+    // an exception from the block cancels the group, skips the continuation, and gets to wait(), instead of leaving wait() hanging.
+    bool then_ran = false;
+    std::string message;
+    cont_task_group g;
+    g.run([&then_ran] {
+        define_task_block_then([](task_block& tb) {
+            tb.run([] {});
+            throw std::runtime_error("thrown by the block");
+        }, [&then_ran] {
+            then_ran = true;
+        });
+    });
+    try
+    {
+        g.wait();
+    }
+    catch (const std::exception& e)
+    {
+        message = e.what();
+    }
+    Check(message == "thrown by the block" && !then_ran, "task block then: an exception from the block cancels the continuation and gets to wait()");
+}
+
+static void CheckMoveOnlyClosures()
+{
+    std::atomic<int> sum(0);
+    cont<int> c;
+    cont_task_group g;
+
+    // closures that can only be moved go straight into their tasks.
+    std::unique_ptr<int> first(new int(1));
+    g.run([p = std::move(first), &sum] { sum += *p; });
+
+    std::unique_ptr<int> second(new int(2));
+    g.with(c).run([p = std::move(second), &sum, &c] { sum += *p + *c; });
+
+    // and so do big ones, without a copy on the way.
+    std::array<int, 1024> table;
+    table.fill(1);
+    g.run([table, &sum] {
+        int total = 0;
+        for (int x : table)
+        {
+            total += x;
+        }
+        sum += total;
+    });
+
+    c.emplace(3);
+    c.set_ready();
+    g.wait();
+
+    Check(sum == 1 + 2 + 3 + 1024, "move-only closures: all the closures run");
+}
+
+static void CheckGraphReplay()
+{
+    const int num_parts = 64;
+    const int num_frames = 100;
+
+    std::vector<cont<int>> parts(num_parts);
+    std::vector<cont_base*> inputs(num_parts);
+    for (int i = 0; i < num_parts; i++)
+    {
+        inputs[i] = &parts[i];
+    }
+    cont<long long> total;
+    int frame = 0;
+    cont_task_group g;
+
+    // every frame run through the group again.
+    bool rebuilt_right = true;
+    for (frame = 0; frame < num_frames; frame++)
+    {
+        AddFrameTasks(g, frame, parts, inputs, total);
+        g.wait();
+        rebuilt_right = rebuilt_right && *total == FrameTotal(frame, num_parts);
+
+        for (cont<int>& part : parts)
+        {
+            part.reset();
+        }
+        total.reset();
+    }
+    Check(rebuilt_right, "graph replay: the frames run through the group add up");
+
+    // captured once, and replayed for every frame. the total is an output of the graph that nothing in it waits for.
+    cont_graph graph;
+    g.begin_capture(graph);
+    AddFrameTasks(g, frame, parts, inputs, total);
+    g.capture_output(total);
+    g.end_capture();
+
+    bool replayed_right = true;
+    for (frame = 0; frame < num_frames; frame++)
+    {
+        graph.replay();
+        replayed_right = replayed_right && *total == FrameTotal(frame, num_parts);
+    }
+    Check(replayed_right, "graph replay: every replay adds up the frame it's replayed for");
+}
+
+static void CheckGraphPatch()
+{
+    cont<int> a, b;
+    std::unique_ptr<cont<int>> c(new cont<int>());
+    int result = 0, other = 0;
+    int unkeyed = 0;
+    cont_task_group g;
+    cont_graph graph;
+
+    // the producer of a has a key, so it's still matched after a task is added in front of it.
+    g.begin_capture(graph);
+    g.capture_key(0).run([&a] { a.emplace(1); a.set_ready(); });
+    g.with(a).run([&a, &b] { b.emplace(*a + 10); b.set_ready(); });
+    g.with(a).run([&a, &c] { c->emplace(*a + 100); c->set_ready(); });
+    g.with(b).run([&b, &result] { result = *b; });
+    g.with(*c).run([&c, &other] { other = **c; });
+    g.end_capture();
+    graph.replay();
+    Check(result == 11 && other == 101, "graph patch: the first capture replays");
+
+    // the producer and the consumer of c are gone, so the graph forgets c, and it can be destroyed.
+    // the key 0 doesn't match the new task at position 0, since keys and positions are kept apart.
+    g.begin_capture(graph);
+    g.run([&unkeyed] { unkeyed++; });
+    g.capture_key(0).run([&a] { a.emplace(2); a.set_ready(); });
+    g.with(a).run([&a, &b] { b.emplace(*a + 10); b.set_ready(); });
+    g.with(b).run([&b, &result] { result = *b; });
+    g.end_capture();
+    c.reset();
+    graph.replay();
+    graph.replay();
+    Check(result == 12, "graph patch: the patched graph replays the new keyed producer");
+    Check(unkeyed == 2, "graph patch: the new task runs once per replay");
+
+    // a key used twice in the same capture is an error, instead of one task silently taking the place of the other.
+    bool rejected = false;
+    g.begin_capture(graph);
+    try
+    {
+        g.capture_key(1).run([] {});
+        g.capture_key(1).run([] {});
+    }
+    catch (const std::invalid_argument&)
+    {
+        rejected = true;
+    }
+    g.end_capture();
+    Check(rejected, "graph patch: a duplicate key is rejected");
+}
+
+static void CheckDag()
+{
+    const int num_runs = 100;
+    int x = 0, left = 0, right = 0, sum = 0;
+    bool in_order = true;
+
+    // lambdas all have types of their own, so they can name the nodes of a dag.
+    auto source = [&x] { x++; };
+    auto left_fun = [&x, &left] { left = x * 2; };
+    auto right_fun = [&x, &right] { right = x * 3; };
+    auto sink = [&left, &right, &sum] { sum = left + right; };
+
+    typedef dag<node<decltype(source)>,
+                node<decltype(left_fun), deps<decltype(source)>>,
+                node<decltype(right_fun), deps<decltype(source)>>,
+                node<decltype(sink), deps<decltype(left_fun), decltype(right_fun)>>> diamond;
+    diamond d(source, left_fun, right_fun, sink);
+
+    for (int i = 0; i < num_runs; i++)
+    {
+        d.run();
+        in_order = in_order && sum == 5 * (i + 1);
+    }
+    Check(in_order, "dag: every run goes in dependency order");
+
+    // a node that throws skips the nodes after it, and its exception comes out of run() instead of leaving it waiting.
+    bool should_throw = true;
+    int num_sinks = 0;
+    auto first = [] {};
+    auto thrower = [&should_throw] {
+        if (should_throw)
+        {
+            throw std::runtime_error("thrown by a node");
+        }
+    };
+    auto after = [&num_sinks] { num_sinks++; };
+
+    dag<node<decltype(first)>,
+        node<decltype(thrower), deps<decltype(first)>>,
+        node<decltype(after), deps<decltype(thrower)>>> failing(first, thrower, after);
+
+    std::string message;
+    try
+    {
+        failing.run();
+    }
+    catch (const std::exception& e)
+    {
+        message = e.what();
+    }
+    Check(message == "thrown by a node" && num_sinks == 0, "dag: run() rethrows the exception of a node and skips its successors");
+
+    should_throw = false;
+    failing.run();
+    Check(num_sinks == 1, "dag: a dag runs again after a node threw");
+}
+
+static void CheckCompactGraph()
+{
+    const int width = 100;
+    const int depth = 20;
+    const int num_frames = 3;
+
+    std::vector<cont<int>> values(width * depth);
+    cont_task_group g;
+    cont_graph graph;
+    g.begin_capture(graph);
+    AddLayeredTasks(g, values, width, depth);
+    g.end_capture();
+
+    long long expected = LayeredSum(width, depth);
+    bool linked_right = true;
+    for (int frame = 0; frame < num_frames; frame++)
+    {
+        graph.replay();
+        linked_right = linked_right && LastLayerSum(values, width) == expected;
+    }
+    Check(linked_right, "compact graph: the linked graph replays");
+
+    // the same graph, with indices and arrays instead of nodes linked into the conts.
+    compact_graph compact(graph);
+    bool compact_right = true;
+    for (int frame = 0; frame < num_frames; frame++)
+    {
+        compact.replay();
+        compact_right = compact_right && LastLayerSum(values, width) == expected;
+    }
+    Check(compact_right, "compact graph: the compact graph replays with the same results");
+}
+
+static void CheckStaticSchedule()
+{
+    const int width = 64;
+    const int depth = 8;
+
+    std::vector<cont<int>> values(width * depth);
+    cont_task_group g;
+    cont_graph graph;
+    g.begin_capture(graph);
+    AddLayeredTasks(g, values, width, depth);
+    g.end_capture();
+
+    compact_graph compact(graph);
+    compact.replay_and_measure();
+    long long expected = LayeredSum(width, depth);
+    Check(LastLayerSum(values, width) == expected, "static schedule: the measured replay runs the graph");
+
+    Check(compact.build_static_schedule(), "static schedule: a graph of plain tasks gets a schedule");
+    bool same = true;
+    for (int frame = 0; frame < 3; frame++)
+    {
+        compact.replay();
+        same = same && LastLayerSum(values, width) == expected;
+    }
+    Check(same, "static schedule: the static replays give the same results");
+
+    // here the cont is set from a subtask, so the measurements can't tell which task of the graph produces it,
+    // and the graph keeps scheduling dynamically.
+    cont<int> shared;
+    int seen = 0;
+    cont_graph nested_graph;
+    g.begin_capture(nested_graph);
+    g.run([&shared] {
+        cont_task_group sub;
+        sub.run([&shared] { shared.emplace(42); shared.set_ready(); });
+        sub.wait();
+    });
+    g.with(shared).run([&shared, &seen] { seen = *shared; });
+    g.end_capture();
+
+    compact_graph nested(nested_graph);
+    nested.replay_and_measure();
+    Check(!nested.build_static_schedule(), "static schedule: a graph with a producer in a subtask is refused");
+    nested.replay();
+    Check(seen == 42, "static schedule: the refused graph still replays");
+}
+
+static void CheckPriorities()
+{
+    const int chain_length = 8;
+    const int num_short = 16;
+
+    cont<int> start_cont;
+    std::vector<cont<int>> chain(chain_length);
+    std::atomic<int> num_short_ran(0);
+    cont_task_group g;
+    cont_graph graph;
+    g.begin_capture(graph);
+    g.run([&start_cont] { start_cont.emplace(0); start_cont.set_ready(); });
+    for (int i = 0; i < num_short; i++)
+    {
+        g.with(start_cont).run([&num_short_ran] { num_short_ran++; });
+    }
+    for (int i = 0; i < chain_length; i++)
+    {
+        cont<int>& in = i == 0 ? start_cont : chain[i - 1];
+        cont<int>& out = chain[i];
+        g.with(in).run([&in, &out] {
+            out.emplace(*in + 1);
+            out.set_ready();
+        });
+    }
+    g.capture_output(chain.back());
+    g.end_capture();
+
+    compact_graph compact(graph);
+    compact.replay_and_measure();
+    compact.build_priorities();
+    num_short_ran = 0;
+    compact.replay();
+
+    Check(*chain.back() == chain_length && num_short_ran == num_short, "priorities: the prioritized graph runs all its tasks");
+}
+
+static void CheckNotifyOrder()
+{
+    const int num_consumers = 64;
+
+    for (notify_order order : { notify_order::last_registered_first, notify_order::first_registered_first })
+    {
+        std::atomic<long long> sum(0);
+        cont<int> c;
+        cont_task_group g;
+        for (int i = 0; i < num_consumers; i++)
+        {
+            g.with(c).run([&c, &sum, i] { sum += *c + i; });
+        }
+        c.emplace(1000);
+        c.set_ready(order);
+        g.wait();
+
+        Check(sum == 1000LL * num_consumers + num_consumers * (num_consumers - 1) / 2, order == notify_order::first_registered_first
+            ? "notify order: all the consumers run first registered first"
+            : "notify order: all the consumers run last registered first");
+    }
+}
+
+static void CheckProducerAffinity()
+{
+    const int num_pairs = 16;
+    const int buffer_size = 1024;
+
+    for (cont_affinity affinity : { cont_affinity::none, cont_affinity::producer })
+    {
+        std::vector<std::vector<int>> buffers(num_pairs, std::vector<int>(buffer_size));
+        std::vector<cont<int>> filled(num_pairs);
+        std::vector<long long> sums(num_pairs);
+        cont_task_group g;
+
+        for (int i = 0; i < num_pairs; i++)
+        {
+            filled[i].set_affinity_mode(affinity);
+            g.with(filled[i]).run([&buffers, &sums, i] {
+                long long sum = 0;
+                for (int x : buffers[i])
+                {
+                    sum += x;
+                }
+                sums[i] = sum;
+            });
+        }
+        for (int i = 0; i < num_pairs; i++)
+        {
+            g.run([&buffers, &filled, i] {
+                for (size_t j = 0; j < buffers[i].size(); j++)
+                {
+                    buffers[i][j] = (int)j + i;
+                }
+                filled[i].emplace(i);
+                filled[i].set_ready();
+            });
+        }
+        g.wait();
+
+        bool all_read = true;
+        for (int i = 0; i < num_pairs; i++)
+        {
+            all_read = all_read && sums[i] == (long long)buffer_size * (buffer_size - 1) / 2 + (long long)buffer_size * i;
+        }
+        Check(all_read, affinity == cont_affinity::producer
+            ? "producer affinity: the consumers read what their producers wrote, with the producer's affinity"
+            : "producer affinity: the consumers read what their producers wrote, spawned anywhere");
+    }
+}
+
+// the successors released through a notify hook (a fan-in tree, a prunable task, or the replay of a graph) get the affinity
+// of the producer too, like the ones the cont spawns itself.
+static void CheckSuccessorAffinity()
+{
+    const int num_conts = 256;
+
+    std::vector<cont<int>> conts(num_conts);
+    std::vector<cont_base*> inputs(num_conts);
+    for (int i = 0; i < num_conts; i++)
+    {
+        conts[i].set_affinity_mode(cont_affinity::producer);
+        inputs[i] = &conts[i];
+    }
+    cont<int> pruned_out;
+
+    std::atomic<int> producer_affinity(-1);
+    std::atomic<int> plain_affinity(-1), fan_in_affinity(-1), prunable_affinity(-1);
+    cont_task_group g;
+    g.with(conts[0]).run([&plain_affinity] { plain_affinity = (int)tbb::task::self().affinity(); });
+    g.with_all(inputs.data(), num_conts).run([&fan_in_affinity] { fan_in_affinity = (int)tbb::task::self().affinity(); });
+    g.with(conts[1]).or_prune(pruned_out).run([&prunable_affinity, &pruned_out] {
+        prunable_affinity = (int)tbb::task::self().affinity();
+        pruned_out.set_ready();
+    });
+    g.run([&conts, &producer_affinity] {
+        producer_affinity = (int)current_affinity_id();
+        for (cont<int>& c : conts)
+        {
+            c.emplace(1);
+            c.set_ready();
+        }
+    });
+    g.wait();
+
+    Check(producer_affinity > 0 && plain_affinity == producer_affinity, "successor affinity: a successor gets the producer's affinity");
+    Check(fan_in_affinity == producer_affinity, "successor affinity: a successor behind a fan-in tree gets the producer's affinity");
+    Check(prunable_affinity == producer_affinity, "successor affinity: a prunable successor gets the producer's affinity");
+
+    // and in a graph, where the producer is a task of the graph too.
+    cont<int> c;
+    c.set_affinity_mode(cont_affinity::producer);
+    std::atomic<int> graph_producer(-1), graph_consumer(-1), compact_consumer(-1);
+    std::atomic<int>* consumer_affinity = &graph_consumer;
+    cont_graph graph;
+    g.begin_capture(graph);
+    g.run([&c, &graph_producer] {
+        graph_producer = (int)current_affinity_id();
+        c.emplace(1);
+        c.set_ready();
+    });
+    g.with(c).run([&consumer_affinity] { *consumer_affinity = (int)tbb::task::self().affinity(); });
+    g.end_capture();
+    graph.replay();
+    Check(graph_producer > 0 && graph_consumer == graph_producer, "successor affinity: a replayed successor gets the producer's affinity");
+
+    compact_graph compact(graph);
+    consumer_affinity = &compact_consumer;
+    compact.replay();
+    Check(compact_consumer == graph_producer, "successor affinity: a successor in a compact graph gets the producer's affinity");
+}
+
+static void CheckAffinityMemory()
+{
+    const int num_tasks = 16;
+    const int num_frames = 5;
+
+    for (bool enabled : { false, true })
+    {
+        std::vector<int> counts(num_tasks, 0);
+        cont_task_group g;
+        cont_graph graph;
+        g.begin_capture(graph);
+        for (int i = 0; i < num_tasks; i++)
+        {
+            g.run([&counts, i] { counts[i]++; });
+        }
+        g.end_capture();
+        graph.set_affinity_memory(enabled);
+
+        for (int frame = 0; frame < num_frames; frame++)
+        {
+            graph.replay();
+        }
+
+        bool all_ran = true;
+        for (int count : counts)
+        {
+            all_ran = all_ran && count == num_frames;
+        }
+        Check(all_ran, enabled ? "affinity memory: every task runs once per replay, where it ran before" : "affinity memory: every task runs once per replay");
+    }
+}
+
+static void CheckNumaPinning()
+{
+    const int num_tasks = 16;
+
+    numa_arenas arenas;
+    cont_task_group g;
+    Check(arenas.num_nodes() >= 1, "numa pinning: there's an arena for at least one node");
+
+    // the tasks sent to the arena of every node run, and the group waits for them.
+    std::atomic<int> ran(0);
+    for (int node = 0; node < arenas.num_nodes(); node++)
+    {
+        for (int i = 0; i < num_tasks; i++)
+        {
+            g.run_in(arenas.arena(node), [&ran] { ran++; });
+        }
+    }
+    g.wait();
+    Check(ran == arenas.num_nodes() * num_tasks, "numa pinning: the tasks sent to the arenas of the nodes all run");
+}
+
+static void CheckArenaRelease()
+{
+    const int num_consumers = 16;
+    const int num_rounds = 100;
+
+    // the consumers are registered from the default arena, and the producer runs in an arena of its own, with a single thread.
+    default_arena_tracker home;
+    tbb::task_arena other(1);
+    other.initialize();
+    arena_tracker other_tracker(other);
+
+    std::atomic<long long> sum(0);
+    cont_task_group g;
+    for (int round = 0; round < num_rounds; round++)
+    {
+        cont<int> c;
+        for (int i = 0; i < num_consumers; i++)
+        {
+            g.with(c).run([&c, &sum] { sum += *c; });
+        }
+        g.run_in(other, [&c, round] {
+            c.emplace(round);
+            c.set_ready();
+        });
+        g.wait();
+    }
+
+    Check(sum == (long long)num_consumers * num_rounds * (num_rounds - 1) / 2, "arena release: the consumers released from another arena all run");
+}
+
+static void CheckGraphPool()
+{
+    const int num_tasks = 1000;
+
+    // the big closures go in the pool when there is one, and the small ones stay in their tasks either way.
+    graph_pool pool;
+    for (graph_pool* p : { (graph_pool*)NULL, &pool })
+    {
+        std::atomic<long long> sum(0);
+        cont<int> one;
+        one.emplace(1);
+        one.set_ready();
+        cont_task_group g;
+        g.use_pool(p);
+        for (int i = 0; i < num_tasks; i++)
+        {
+            std::array<int, 64> payload;
+            payload.fill(i);
+            g.run([&sum, payload] { sum += payload[0] + payload[63]; });
+            g.run([&sum, i] { sum += i; });
+            g.with(one).run([&sum, &one] { sum += *one; });
+        }
+        g.wait();
+        pool.clear();
+
+        long long expected = (long long)num_tasks * (num_tasks - 1) * 3 / 2 + num_tasks;
+        Check(sum == expected, p != NULL ? "graph pool: the closures run with a pool" : "graph pool: the closures run without a pool");
+    }
+}
+
+static void CheckSlabAllocator()
+{
+    const int num_chains = 100;
+    const int chain_length = 10;
+
+    slab_allocator slabs;
+    std::atomic<long long> sum(0);
+    cont_task_group g;
+
+    // pipelines of tasks that each make a cont on the slabs for the next one, which frees it, often on another thread.
+    for (int chain = 0; chain < num_chains; chain++)
+    {
+        g.run([&g, &sum, &slabs, chain] {
+            cont<int>* c = slabs.make_cont<int>();
+            c->emplace(chain);
+            c->set_ready();
+            for (int i = 0; i < chain_length; i++)
+            {
+                cont<int>* next = slabs.make_cont<int>();
+                g.with(*c).run([&sum, &slabs, c, next] {
+                    next->emplace(**c + 1);
+                    sum += **c;
+                    slabs.destroy(c);
+                    next->set_ready();
+                });
+                c = next;
+            }
+            g.with(*c).run([&sum, &slabs, c] {
+                sum += **c;
+                slabs.destroy(c);
+            });
+        });
+    }
+    g.wait();
+
+    // every chain sees chain, chain + 1, ... chain + chain_length.
+    long long expected = (long long)(chain_length + 1) * num_chains * (num_chains - 1) / 2 + (long long)num_chains * chain_length * (chain_length + 1) / 2;
+    Check(sum == expected, "slab allocator: every cont from the slabs gets to its consumer");
+}
+
+static void CheckSharedConts()
+{
+    const int num_conts = 1000;
+    const int num_consumers = 4;
+    std::atomic<long long> sum(0);
+    cont_task_group g;
+
+    // the handles of the loop are gone before the conts are ready, and the consumers only keep a plain reference:
+    // the conts are kept alive by the tasks registered on them, and by their producers.
+    for (int i = 0; i < num_conts; i++)
+    {
+        shared_cont<std::vector<int>> c;
+        cont<std::vector<int>>& values = c.get();
+        for (int j = 0; j < num_consumers; j++)
+        {
+            g.with(c).run([&values, &sum, j] { sum += (*values)[j]; });
+        }
+        g.run([c, i] {
+            c.emplace((size_t)num_consumers, i);
+            c.set_ready();
+        });
+    }
+    g.wait();
+
+    Check(sum == (long long)num_consumers * num_conts * (num_conts - 1) / 2, "shared conts: the conts live until all their consumers ran");
+}
+
+// a frame of image passes, where every pass reads two buffers of the previous layer and writes one.
+static void CheckAliasStorage()
+{
+    const int width = 8;
+    const int depth = 16;
+    typedef std::array<float, 4096> buffer;
+
+    std::vector<transient_cont<buffer>> buffers(width * depth);
+    std::atomic<long long> checksum(0);
+    cont_task_group g;
+    cont_graph graph;
+    g.begin_capture(graph);
+    for (int layer = 0; layer < depth; layer++)
+    {
+        for (int i = 0; i < width; i++)
+        {
+            transient_cont<buffer>& out = buffers[layer * width + i];
+            if (layer == 0)
+            {
+                g.run([&out, i] {
+                    out.emplace();
+                    out->fill((float)i);
+                    out.set_ready();
+                });
+                continue;
+            }
+
+            transient_cont<buffer>& a = buffers[(layer - 1) * width + i];
+            transient_cont<buffer>& b = buffers[(layer - 1) * width + (i + 1) % width];
+            if (layer == depth - 1)
+            {
+                g.with(a, b).run([&a, &b, &checksum, i] {
+                    checksum += (long long)((*a)[i] + (*b)[i]);
+                });
+                continue;
+            }
+
+            g.with(a, b).run([&out, &a, &b] {
+                out.emplace();
+                for (size_t k = 0; k < out->size(); k++)
+                {
+                    (*out)[k] = (*a)[k] * 0.5f + (*b)[k] * 0.25f + 1.0f;
+                }
+                out.set_ready();
+            });
+        }
+    }
+    g.end_capture();
+    g.wait();
+
+    compact_graph compact(graph);
+    checksum = 0;
+    compact.replay_and_measure();
+    long long expected = checksum;
+
+    std::vector<transient_cont_base*> transients;
+    for (int i = 0; i < width * (depth - 1); i++)
+    {
+        transients.push_back(&buffers[i]);
+    }
+    size_t aliased = compact.alias_storage(transients.data(), (int)transients.size());
+    Check(aliased > 0 && aliased < transients.size() * sizeof(buffer), "alias storage: the buffers share memory");
+
+    bool same = true;
+    for (int frame = 0; frame < 3; frame++)
+    {
+        checksum = 0;
+        compact.replay();
+        same = same && checksum == expected;
+    }
+    Check(same, "alias storage: the aliased replays give the same results");
+}
+
+// tasks that update random resources from other ones, which have to give the same results as running them in order.
+// some tasks list the resource they write twice, or also as a read.
+static void CheckResourceGraph()
+{
+    const int num_resources = 20;
+    const int num_tasks = 2000;
+
+    resource_graph graph;
+    std::vector<resource_graph::resource> resources;
+    for (int i = 0; i < num_resources; i++)
+    {
+        resources.push_back(graph.named("buffer " + std::to_string(i)));
+    }
+
+    std::vector<long long> values(num_resources, 0), expected(num_resources, 0);
+    std::atomic<int> stale_reads(0);
+    std::mt19937 random(0);
+    for (int t = 0; t < num_tasks; t++)
+    {
+        int a = (int)(random() % num_resources);
+        int w = (int)(random() % num_resources);
+        switch (random() % 4)
+        {
+        case 0:
+        {
+            long long seen = expected[a];
+            graph.run({ resources[a] }, {}, [&values, &stale_reads, a, seen] {
+                if (values[a] != seen)
+                {
+                    stale_reads++;
+                }
+            });
+            break;
+        }
+        case 1:
+            expected[w] = expected[w] * 7 + expected[a] + t;
+            graph.run({ resources[a], resources[w] }, { resources[w] }, [&values, a, w, t] { values[w] = values[w] * 7 + values[a] + t; });
+            break;
+        case 2:
+            expected[w] = expected[w] * 7 + expected[a] + t;
+            graph.run({ resources[a] }, { resources[w], resources[w] }, [&values, a, w, t] { values[w] = values[w] * 7 + values[a] + t; });
+            break;
+        default:
+            expected[w] = expected[a] + t;
+            graph.run({ resources[a] }, { resources[w] }, [&values, a, w, t] { values[w] = values[a] + t; });
+            break;
+        }
+    }
+    graph.wait();
+
+    Check(values == expected, "resource graph: the writes give the same results as in order");
+    Check(stale_reads == 0, "resource graph: the reads see the writes before them");
+}
+
+// lazy conts of which only some are needed: by a consumer, or on demand without any. the producers count how many of them finished
+// after setting their cont ready, which wait() has to include, since they're tasks of the group once they're set off.
+static void CheckLazyProducers()
+{
+    const int num_conts = 64;
+
+    std::vector<cont<int>> conts(num_conts);
+    std::atomic<int> finished(0);
+    std::atomic<long long> sum(0);
+    cont_task_group g;
+    for (int i = 0; i < num_conts; i++)
+    {
+        cont<int>& c = conts[i];
+        g.run_lazy(c, [&c, &finished, i] {
+            c.emplace(i);
+            c.set_ready();
+            finished++;
+        });
+    }
+
+    // every fourth cont has a consumer, and the last one is only demanded.
+    int num_needed = 0;
+    long long expected = 0;
+    for (int i = 0; i < num_conts; i += 4)
+    {
+        cont<int>& c = conts[i];
+        g.with(c).run([&c, &sum] { sum += *c; });
+        num_needed++;
+        expected += i;
+    }
+    conts[num_conts - 1].demand();
+    num_needed++;
+
+    g.wait();
+    Check(finished == num_needed, "lazy producers: exactly the needed producers ran, and wait() waited for them");
+    Check(sum == expected, "lazy producers: the consumers see their lazy conts");
+    Check(!conts[1].is_ready(), "lazy producers: a cont nobody needs isn't produced");
+
+    // the producers that were never needed are dropped with their conts, or when the conts are reset.
+    for (int i = 1; i < num_conts - 1; i++)
+    {
+        if (i % 4 != 0)
+        {
+            conts[i].reset();
+        }
+    }
+}
+
+// a seed (a prunable task without any conts, which runs right away), a choice between branches of stages that depend on it,
+// and a consumer at the end of every branch. the branches that aren't taken are pruned, and their stages skipped without running.
+static void CheckBranchPruning()
+{
+    const int num_branches = 4;
+    const int num_stages = 16;
+
+    cont<int> seed;
+    std::vector<cont<int>> taken(num_branches);
+    std::vector<cont<int>> stages(num_branches * num_stages);
+    std::atomic<int> num_ran(0);
+    std::atomic<int> num_pruned_ends(0);
+    std::atomic<int> result(-1);
+    cont_task_group g;
+
+    g.with().or_prune(seed).run([&seed] {
+        seed.emplace(2);
+        seed.set_ready();
+    });
+
+    g.with(seed).run([&seed, &taken] {
+        for (int b = 0; b < num_branches; b++)
+        {
+            if (b == *seed)
+            {
+                taken[b].emplace(b * 1000);
+                taken[b].set_ready();
+            }
+            else
+            {
+                taken[b].set_pruned();
+            }
+        }
+    });
+
+    for (int b = 0; b < num_branches; b++)
+    {
+        for (int i = 0; i < num_stages; i++)
+        {
+            cont<int>& in = i == 0 ? taken[b] : stages[b * num_stages + i - 1];
+            cont<int>& out = stages[b * num_stages + i];
+            g.with(in).or_prune(out).run([&in, &out, &num_ran] {
+                num_ran++;
+                out.emplace(*in + 1);
+                out.set_ready();
+            });
+        }
+
+        cont<int>& last = stages[b * num_stages + num_stages - 1];
+        g.with(last).run([&last, &result, &num_pruned_ends] {
+            if (last.is_pruned())
+            {
+                num_pruned_ends++;
+            }
+            else
+            {
+                result = *last;
+            }
+        });
+    }
+    g.wait();
+
+    Check(num_ran == num_stages, "branch pruning: only the stages of the taken branch run");
+    Check(num_pruned_ends == num_branches - 1, "branch pruning: the consumers of the other branches see them pruned");
+    Check(result == 2 * 1000 + num_stages, "branch pruning: the taken branch gives its result");
+}
+
+// newton's method for a square root, with a few iterations unrolled ahead of the test for convergence, and a second loop
+// whose test throws, in a group of its own, since the exception cancels it. the handles of the loops are gone before they're over,
+// and the results are read by the tasks of another group.
+static void CheckContLoop()
+{
+    const int depth = 4;
+    const double x = 2.0;
+
+    // the two loops share their group with the consumers of their results, since the one that fails doesn't cancel it.
+    cont_task_group g;
+    double root = 0.0;
+    int iterations = 0;
+    bool diverged_pruned = false;
+    std::string error = "nothing";
+    {
+        auto loop = make_cont_loop<double>(g, depth,
+            [&g, x](int, const shared_cont<double>& prev, const shared_cont<double>& next) {
+                g.with(prev).run([prev, next, x] {
+                    next.emplace((*prev + x / *prev) * 0.5);
+                    next.set_ready();
+                });
+            },
+            [x](int, const double& y) {
+                return std::abs(y * y - x) < 1e-12;
+            });
+        loop.run(x);
+        shared_cont<double> result = loop.result();
+        g.with(result).run([result, loop, &root, &iterations] {
+            root = *result;
+            iterations = loop.iterations();
+        });
+
+        auto diverging = make_cont_loop<double>(g, depth,
+            [&g](int, const shared_cont<double>& prev, const shared_cont<double>& next) {
+                g.with(prev).run([prev, next] {
+                    next.emplace(*prev * 2.0);
+                    next.set_ready();
+                });
+            },
+            [](int, const double& y) -> bool {
+                if (y > 1e6)
+                {
+                    throw std::runtime_error("the loop diverged");
+                }
+                return false;
+            });
+        diverging.run(1.0);
+        shared_cont<double> diverged = diverging.result();
+        g.with(diverged).run([diverged, diverging, &diverged_pruned, &error] {
+            diverged_pruned = diverged.is_pruned();
+            if (diverged_pruned)
+            {
+                try
+                {
+                    std::rethrow_exception(diverging.error());
+                }
+                catch (const std::exception& e)
+                {
+                    error = e.what();
+                }
+            }
+        });
+    }
+
+    bool cancelled = false;
+    try
+    {
+        g.wait();
+    }
+    catch (...)
+    {
+        cancelled = true;
+    }
+
+    Check(std::abs(root * root - x) < 1e-12, "cont loop: the loop converges to the square root");
+    Check(iterations == 5, "cont loop: newton's method from 2 stops after 5 iterations");
+    Check(error == "the loop diverged", "cont loop: the exception of the test comes with the pruned result");
+    Check(diverged_pruned, "cont loop: the result of the failed loop is pruned");
+    Check(!cancelled, "cont loop: the failed loop doesn't cancel the group it shares");
+}
+
+int RunChecks()
+{
+    CheckFanIn();
+    CheckCompletionTracking();
+    CheckCompletion();
+    CheckRunRange();
+    CheckTaskBlock();
+    CheckTaskBlockThen();
+    CheckMoveOnlyClosures();
+    CheckGraphReplay();
+    CheckGraphPatch();
+    CheckDag();
+    CheckCompactGraph();
+    CheckStaticSchedule();
+    CheckPriorities();
+    CheckNotifyOrder();
+    CheckProducerAffinity();
+    CheckSuccessorAffinity();
+    CheckAffinityMemory();
+    CheckNumaPinning();
+    CheckArenaRelease();
+    CheckGraphPool();
+    CheckSlabAllocator();
+    CheckSharedConts();
+    CheckAliasStorage();
+    CheckResourceGraph();
+    CheckLazyProducers();
+    CheckBranchPruning();
+    CheckContLoop();
+
+    std::cout << "checks: " << num_checks - num_failed << " of " << num_checks << " passed\n";
+    return num_failed;
+}
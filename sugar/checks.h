@@ -0,0 +1,6 @@
+// checks that go through the features of the conts one at a time, on graphs small enough to know the results of.
+
+#pragma once
+
+// runs all the checks, reports the ones that fail, and returns how many of them did.
+int RunChecks();
@@ -0,0 +1,909 @@
+// a compact form of a captured graph for replaying huge graphs, with static schedules, priorities, and transient conts whose memory it shares.
+
+#pragma once
+
+#include "cont_graph.h"
+
+#include <tbb/task.h>
+#include <tbb/cache_aligned_allocator.h>
+#include <tbb/task_arena.h>
+#include <tbb/tick_count.h>
+
+#include <cassert>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+#include <queue>
+#include <utility>
+#include <memory>
+#include <new>
+#include <algorithm>
+
+class compact_graph;
+
+// a cont whose value lives in memory that compact_graph::alias_storage() can share with the other transient conts of a graph
+// whose values are never needed at the same time, like the intermediate buffers of a frame. until then (or outside of a graph),
+// it has memory of its own, which is only allocated once a value is put in it.
+// sharing the memory means that a value only lasts until the next cont that shares its memory gets a value of its own,
+// so it should only be read by the consumers of the cont, and only before they set their own outputs ready.
+class transient_cont_base : public cont_base
+{
+    friend class compact_graph;
+
+protected:
+    // memory that transient conts take turns in. the cont that got a value in it last is its occupant.
+    struct storage_slot
+    {
+        char* memory = NULL;
+        size_t size = 0;
+        transient_cont_base* occupant = NULL;
+    };
+
+    // the values of any type are kept cache-aligned, which is as much alignment as they can ask for.
+    static const size_t max_alignment = 64;
+
+    storage_slot _own_slot;
+    storage_slot* _slot = &_own_slot;
+    size_t _size;
+    void (*_destroy)(void* value);
+    bool _has_value = false;
+
+    // the graph whose memory this cont shares, if any, which it leaves when it's destroyed.
+    compact_graph* _graph = NULL;
+    size_t _graph_index = 0;
+
+    transient_cont_base(size_t size, void (*destroy)(void* value))
+        : _size(size)
+        , _destroy(destroy)
+    { }
+
+    ~transient_cont_base();
+
+    void free_own_memory()
+    {
+        if (_own_slot.memory != NULL)
+        {
+            tbb::cache_aligned_allocator<char>().deallocate(_own_slot.memory, _own_slot.size);
+            _own_slot.memory = NULL;
+            _own_slot.size = 0;
+        }
+    }
+
+    // makes room for a new value. by the time this cont gets a value, the previous occupant of its memory is done with it,
+    // so the old value goes away here.
+    void* take_storage()
+    {
+        if (_slot->occupant != NULL)
+        {
+            _slot->occupant->discard();
+        }
+
+        if (_slot->memory == NULL)
+        {
+            _slot->memory = tbb::cache_aligned_allocator<char>().allocate(_size);
+            _slot->size = _size;
+        }
+
+        _slot->occupant = this;
+        return _slot->memory;
+    }
+
+    void* value() const
+    {
+        return _slot->memory;
+    }
+
+public:
+    transient_cont_base(const transient_cont_base&) = delete;
+    transient_cont_base& operator=(const transient_cont_base&) = delete;
+
+    size_t size() const
+    {
+        return _size;
+    }
+
+    // destroys the value early, if there is one.
+    void discard()
+    {
+        if (_has_value)
+        {
+            _has_value = false;
+            _destroy(_slot->memory);
+        }
+    }
+};
+
+template<class T>
+class transient_cont : public transient_cont_base
+{
+public:
+    transient_cont()
+        : transient_cont_base(sizeof(T), [](void* value) { ((T*)value)->~T(); })
+    {
+        static_assert(alignof(T) <= max_alignment, "transient conts only align their values to cache lines");
+    }
+
+    T* operator->()
+    {
+        return (T*)value();
+    }
+
+    const T* operator->() const
+    {
+        return (const T*)value();
+    }
+
+    T& operator*()
+    {
+        return *(T*)value();
+    }
+
+    const T& operator*() const
+    {
+        return *(const T*)value();
+    }
+
+    template<class... Args>
+    void emplace(Args&&... args)
+    {
+        assert(!is_ready());
+
+        void* storage = take_storage();
+        new (storage) T(std::forward<Args>(args)...);
+        _has_value = true;
+    }
+};
+
+// a compact way to replay a captured cont_graph, for huge graphs: the tasks are numbered, their pending input counts sit in one dense array,
+// and the consumers of each cont are one slice of a single array of task numbers (CSR-style), so notifying doesn't chase pointers.
+// every cont gets a single node with a notify hook instead of one node per consumer, and the closures of the tasks are kept apart
+// from all that, in the tasks of the cont_graph, which only get run by the compact graph, not spawned.
+// it's built from the graph as it is, so it has to be rebuilt after the graph is patched, and it can't outlive the graph.
+//
+// it can also replay from a static schedule (see build_static_schedule), where the tasks are split ahead of time into one list per worker.
+class compact_graph
+{
+    // runs the closure of one task of the graph. allocated for every task that becomes ready, and freed once it ran.
+    class compact_task : public tbb::task
+    {
+        compact_graph* _graph;
+        uint32_t _index;
+
+    public:
+        compact_task(compact_graph* graph, uint32_t index)
+            : _graph(graph)
+            , _index(index)
+        { }
+
+        tbb::task* execute() override
+        {
+            _graph->run_payload(_index);
+            return NULL;
+        }
+    };
+
+    // runs the list of a worker of the static schedule, starting from a task that is known to be ready.
+    // when it gets to a task that still misses inputs, it stops, and the last of these inputs to arrive spawns the rest of the list.
+    class list_task : public tbb::task
+    {
+        compact_graph* _graph;
+        uint32_t _position;
+
+    public:
+        list_task(compact_graph* graph, uint32_t position)
+            : _graph(graph)
+            , _position(position)
+        { }
+
+        tbb::task* execute() override
+        {
+            compact_graph* g = _graph;
+            uint32_t end = g->_list_offsets[g->_list_of[g->_list_tasks[_position]] + 1];
+
+            for (uint32_t p = _position; ; )
+            {
+                g->run_payload(g->_list_tasks[p]);
+
+                if (++p == end || !g->arrive(g->_list_tasks[p]))
+                {
+                    return NULL;
+                }
+            }
+        }
+    };
+
+    cont_graph* _graph;
+    tbb::task* _frame;
+
+    // number of inputs of each task, and how many of them are still missing in the current replay.
+    std::vector<int> _num_inputs;
+    std::vector<std::atomic<int>> _pending;
+
+    // the consumers of cont c are _consumers[_consumer_offsets[c]] to _consumers[_consumer_offsets[c + 1] - 1].
+    std::vector<uint32_t> _consumer_offsets;
+    std::vector<uint32_t> _consumers;
+
+    std::vector<cont_base*> _conts;
+    std::vector<cont_node> _hooks;
+    std::vector<uint32_t> _sources;
+
+    std::vector<cont_graph::graph_task*> _payloads;
+
+    // measurements of replay_and_measure(): how long every task ran, and which task set every cont ready (or -1 if none did.)
+    bool _measuring = false;
+    bool _measured = false;
+    std::vector<double> _durations;
+    std::vector<int> _producers;
+
+    // the static schedule, if any: the tasks of worker w are _list_tasks[_list_offsets[w]] to _list_tasks[_list_offsets[w + 1] - 1].
+    std::vector<uint32_t> _list_offsets;
+    std::vector<uint32_t> _list_tasks;
+    std::vector<uint32_t> _list_of;
+    std::vector<uint32_t> _position_of;
+
+    // with set_affinity_memory(true), the thread that ran each task last, which it's spawned with in the next replay.
+    std::vector<tbb::task::affinity_id> _affinities;
+
+    // the transient conts that share memory since alias_storage(), and that memory.
+    std::vector<transient_cont_base*> _transients;
+    std::vector<std::unique_ptr<transient_cont_base::storage_slot>> _slots;
+
+    // the task of this graph that the current thread is running, and the tbb task it runs in, used to find out who sets the conts ready.
+    struct running_task
+    {
+        int index = -1;
+        tbb::task* runner = NULL;
+    };
+
+    static running_task& current_task()
+    {
+        static thread_local running_task current;
+        return current;
+    }
+
+    bool has_static_schedule() const
+    {
+        return !_list_offsets.empty();
+    }
+
+    void run_payload(uint32_t index)
+    {
+        if (!_affinities.empty())
+        {
+            _affinities[index] = current_affinity_id();
+        }
+
+        if (_measuring)
+        {
+            running_task& current = current_task();
+            running_task previous = current;
+            current.index = (int)index;
+            current.runner = &tbb::task::self();
+
+            tbb::tick_count start = tbb::tick_count::now();
+            _payloads[index]->run();
+            _durations[index] = (tbb::tick_count::now() - start).seconds();
+
+            current = previous;
+        }
+        else
+        {
+            _payloads[index]->run();
+        }
+
+        _frame->decrement_ref_count();
+    }
+
+    // counts one input of the task as arrived, and returns true if it was the last one.
+    bool arrive(uint32_t index)
+    {
+        return _pending[index].fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    // the task that runs the given task once it's ready: the rest of its list with a static schedule, or just the task otherwise.
+    tbb::task& allocate_ready_task(uint32_t index)
+    {
+        if (has_static_schedule())
+        {
+            list_task& t = *new (tbb::task::allocate_root(_graph->_context)) list_task(this, _position_of[index]);
+            // the affinity is only a hint: any worker can still steal the list if its own worker is busy.
+            t.set_affinity((tbb::task::affinity_id)(_list_of[index] + 1));
+            return t;
+        }
+
+        compact_task& t = *new (tbb::task::allocate_root(_graph->_context)) compact_task(this, index);
+        if (!_affinities.empty())
+        {
+            t.set_affinity(_affinities[index]);
+        }
+        return t;
+    }
+
+    // the affinity the cont asks for comes before the one remembered from the previous replay, but a static schedule keeps its own.
+    void release_ready_task(uint32_t index, tbb::task_list& ready_tasks, bool& any_ready, tbb::task::affinity_id affinity = 0)
+    {
+        tbb::task& t = allocate_ready_task(index);
+        if (affinity != 0 && !has_static_schedule())
+        {
+            t.set_affinity(affinity);
+        }
+
+        ready_tasks.push_back(t);
+        any_ready = true;
+    }
+
+    static void notify(cont_node* node, tbb::task::affinity_id affinity)
+    {
+        compact_graph* g = (compact_graph*)node->context;
+        size_t c = node - g->_hooks.data();
+
+        if (g->_measuring)
+        {
+            // a cont set from another tbb task than the one that runs the graph task, like a subtask that it spawned,
+            // or a task that a nested wait stole, can't be tied to a task of the graph, so its producer stays unknown.
+            const running_task& current = current_task();
+            g->_producers[c] = &tbb::task::self() == current.runner ? current.index : -1;
+        }
+
+        tbb::task_list ready_tasks;
+        bool any_ready = false;
+
+        for (uint32_t i = g->_consumer_offsets[c]; i != g->_consumer_offsets[c + 1]; i++)
+        {
+            uint32_t consumer = g->_consumers[i];
+            if (g->arrive(consumer))
+            {
+                g->release_ready_task(consumer, ready_tasks, any_ready, affinity);
+            }
+        }
+
+        if (any_ready)
+        {
+            tbb::task::spawn(ready_tasks);
+        }
+    }
+
+    void replay(bool measure)
+    {
+        _measuring = measure;
+
+        // with a static schedule, the list of a task counts as one more input, which arrives when the list gets to the task.
+        int list_input = has_static_schedule() ? 1 : 0;
+        for (size_t i = 0; i < _pending.size(); i++)
+        {
+            _pending[i].store(_num_inputs[i] + list_input, std::memory_order_relaxed);
+        }
+
+        if (measure)
+        {
+            std::fill(_producers.begin(), _producers.end(), -1);
+        }
+
+        for (size_t c = 0; c < _conts.size(); c++)
+        {
+            _conts[c]->rearm(&_hooks[c]);
+        }
+
+        _frame->set_ref_count((int)_payloads.size() + 1);
+
+        tbb::task_list ready_tasks;
+        bool any_ready = false;
+
+        if (has_static_schedule())
+        {
+            for (size_t w = 0; w + 1 < _list_offsets.size(); w++)
+            {
+                if (_list_offsets[w] != _list_offsets[w + 1] && arrive(_list_tasks[_list_offsets[w]]))
+                {
+                    ready_tasks.push_back(allocate_ready_task(_list_tasks[_list_offsets[w]]));
+                    any_ready = true;
+                }
+            }
+        }
+        else
+        {
+            for (uint32_t i : _sources)
+            {
+                release_ready_task(i, ready_tasks, any_ready);
+            }
+        }
+
+        if (any_ready)
+        {
+            tbb::task::spawn(ready_tasks);
+        }
+
+        _frame->wait_for_all();
+        _measuring = false;
+    }
+
+    // what the measurements say about the graph: the edges between tasks through the conts whose producer is known,
+    // the cost of every task, a topological order, and the rank of every task, which is the longest path from it to the end of the graph.
+    struct task_ranks
+    {
+        std::vector<std::vector<uint32_t>> predecessors;
+        std::vector<std::vector<uint32_t>> successors;
+        std::vector<double> costs;
+        std::vector<uint32_t> order;
+        std::vector<double> ranks;
+    };
+
+    task_ranks rank_tasks() const
+    {
+        uint32_t num_tasks = (uint32_t)_payloads.size();
+        task_ranks r;
+
+        // the task-to-task edges, through the conts whose producer is known.
+        r.predecessors.resize(num_tasks);
+        r.successors.resize(num_tasks);
+        for (size_t c = 0; c < _conts.size(); c++)
+        {
+            if (_producers[c] < 0)
+            {
+                continue;
+            }
+
+            for (uint32_t i = _consumer_offsets[c]; i != _consumer_offsets[c + 1]; i++)
+            {
+                r.predecessors[_consumers[i]].push_back((uint32_t)_producers[c]);
+                r.successors[_producers[c]].push_back(_consumers[i]);
+            }
+        }
+
+        // tasks that were too quick to measure still get a tiny cost, so that a task always ranks higher than its successors.
+        r.costs.resize(num_tasks);
+        for (uint32_t i = 0; i < num_tasks; i++)
+        {
+            r.costs[i] = std::max(_durations[i], 1e-9);
+        }
+
+        // topological order, to compute the ranks from the end of the graph backwards.
+        std::vector<int> missing(num_tasks);
+        for (uint32_t i = 0; i < num_tasks; i++)
+        {
+            missing[i] = (int)r.predecessors[i].size();
+            if (missing[i] == 0)
+            {
+                r.order.push_back(i);
+            }
+        }
+        for (size_t i = 0; i < r.order.size(); i++)
+        {
+            for (uint32_t s : r.successors[r.order[i]])
+            {
+                if (--missing[s] == 0)
+                {
+                    r.order.push_back(s);
+                }
+            }
+        }
+        assert(r.order.size() == num_tasks);
+
+        r.ranks.assign(num_tasks, 0.0);
+        for (size_t i = r.order.size(); i-- > 0; )
+        {
+            double longest_successor = 0.0;
+            for (uint32_t s : r.successors[r.order[i]])
+            {
+                longest_successor = std::max(longest_successor, r.ranks[s]);
+            }
+            r.ranks[r.order[i]] = r.costs[r.order[i]] + longest_successor;
+        }
+
+        return r;
+    }
+
+public:
+    explicit compact_graph(cont_graph& graph)
+        : _graph(&graph)
+        , _num_inputs(graph._tasks.size())
+        , _pending(graph._tasks.size())
+        , _conts(graph._conts.size())
+        , _hooks(graph._conts.size())
+        , _payloads(graph._tasks)
+        , _durations(graph._tasks.size(), 0.0)
+        , _producers(graph._conts.size(), -1)
+    {
+        _frame = new (tbb::task::allocate_root(graph._context)) tbb::empty_task();
+
+        std::unordered_map<cont_graph::graph_task*, uint32_t> indices;
+        for (uint32_t i = 0; i < (uint32_t)_payloads.size(); i++)
+        {
+            indices.emplace(_payloads[i], i);
+            _num_inputs[i] = (int)_payloads[i]->inputs.size();
+            if (_num_inputs[i] == 0)
+            {
+                _sources.push_back(i);
+            }
+        }
+
+        _consumer_offsets.push_back(0);
+        for (size_t c = 0; c < graph._conts.size(); c++)
+        {
+            for (cont_graph::graph_task* t : graph._conts[c].consumers)
+            {
+                _consumers.push_back(indices[t]);
+            }
+            _consumer_offsets.push_back((uint32_t)_consumers.size());
+
+            _conts[c] = graph._conts[c].cont;
+            _hooks[c].task = NULL;
+            _hooks[c].next = NULL;
+            _hooks[c].notify = notify;
+            _hooks[c].context = this;
+        }
+    }
+
+    compact_graph(const compact_graph&) = delete;
+    compact_graph& operator=(const compact_graph&) = delete;
+
+    ~compact_graph()
+    {
+        release_storage();
+        tbb::task::destroy(*_frame);
+    }
+
+    // runs all the tasks of the graph once (from the static schedule, if there is one), and waits for all of them to finish.
+    void replay()
+    {
+        replay(false);
+    }
+
+    // like replay(), but always schedules dynamically, and measures how long every task takes and which task produces every cont,
+    // for build_static_schedule() to use.
+    void replay_and_measure()
+    {
+        std::vector<uint32_t> list_offsets;
+        list_offsets.swap(_list_offsets);
+        replay(true);
+        list_offsets.swap(_list_offsets);
+        _measured = true;
+    }
+
+    // splits the tasks into one list per worker ahead of time, from the measurements of the last replay_and_measure(), HEFT-style:
+    // tasks are ranked by the longest path from them to the end of the graph, and in that order,
+    // every task goes to the worker that would finish it first, given when its producers finish.
+    // from then on, replay() runs every list in order as a single task, which only stops to wait for inputs produced by other lists.
+    // returns false, and keeps scheduling dynamically, if a cont that a task of the graph waits for had no known producer:
+    // one set from outside of the graph, or from a subtask of a graph task (see notify.) without knowing the producers,
+    // a list could end up waiting for a task that comes later in the same list, which would never run.
+    bool build_static_schedule(int num_workers = tbb::this_task_arena::max_concurrency())
+    {
+        assert(_measured);
+
+        _list_offsets.clear();
+        for (size_t c = 0; c < _conts.size(); c++)
+        {
+            if (_consumer_offsets[c] != _consumer_offsets[c + 1] && _producers[c] < 0)
+            {
+                return false;
+            }
+        }
+
+        uint32_t num_tasks = (uint32_t)_payloads.size();
+        num_workers = std::max(1, std::min(num_workers, tbb::this_task_arena::max_concurrency()));
+
+        task_ranks analysis = rank_tasks();
+        const std::vector<std::vector<uint32_t>>& predecessors = analysis.predecessors;
+        const std::vector<double>& costs = analysis.costs;
+        std::vector<uint32_t>& order = analysis.order;
+        const std::vector<double>& ranks = analysis.ranks;
+
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return ranks[a] > ranks[b]; });
+
+        std::vector<double> worker_free(num_workers, 0.0);
+        std::vector<double> finish(num_tasks, 0.0);
+        std::vector<std::vector<uint32_t>> lists(num_workers);
+        for (uint32_t t : order)
+        {
+            double inputs_ready = 0.0;
+            for (uint32_t p : predecessors[t])
+            {
+                inputs_ready = std::max(inputs_ready, finish[p]);
+            }
+
+            int best_worker = 0;
+            for (int w = 1; w < num_workers; w++)
+            {
+                if (std::max(worker_free[w], inputs_ready) < std::max(worker_free[best_worker], inputs_ready))
+                {
+                    best_worker = w;
+                }
+            }
+
+            finish[t] = std::max(worker_free[best_worker], inputs_ready) + costs[t];
+            worker_free[best_worker] = finish[t];
+            lists[best_worker].push_back(t);
+        }
+
+        std::vector<uint32_t> list_offsets(1, 0);
+        _list_tasks.clear();
+        _list_of.assign(num_tasks, 0);
+        _position_of.assign(num_tasks, 0);
+        for (int w = 0; w < num_workers; w++)
+        {
+            for (uint32_t t : lists[w])
+            {
+                _list_of[t] = (uint32_t)w;
+                _position_of[t] = (uint32_t)_list_tasks.size();
+                _list_tasks.push_back(t);
+            }
+            list_offsets.push_back((uint32_t)_list_tasks.size());
+        }
+
+        // every task has to come after the producers of its inputs that share its list, or the list would wait on itself.
+        for (uint32_t t = 0; t < num_tasks; t++)
+        {
+            for (uint32_t p : predecessors[t])
+            {
+                if (_list_of[p] == _list_of[t] && _position_of[p] > _position_of[t])
+                {
+                    return false;
+                }
+            }
+        }
+
+        _list_offsets.swap(list_offsets);
+        return true;
+    }
+
+    // goes back to scheduling every replay dynamically.
+    void clear_static_schedule()
+    {
+        _list_offsets.clear();
+    }
+
+    // sorts the consumers of every cont (and the tasks that start the graph) by rank, from the measurements of the last replay_and_measure(),
+    // so that when several tasks become ready at once, the ones with the longest way to go are spawned to run first.
+    // the task on the critical path (the longest path through the graph) has the highest rank of the tasks it's released with,
+    // so it's at the front of their task_list, which the releasing thread runs first, while idle workers steal from the back.
+    void build_priorities()
+    {
+        assert(_measured);
+
+        task_ranks r = rank_tasks();
+
+        // a spawned task_list runs in order on the spawning thread, so the highest ranks go first.
+        auto by_rank = [&](uint32_t a, uint32_t b) { return r.ranks[a] > r.ranks[b]; };
+        for (size_t c = 0; c < _conts.size(); c++)
+        {
+            std::stable_sort(_consumers.begin() + _consumer_offsets[c], _consumers.begin() + _consumer_offsets[c + 1], by_rank);
+        }
+        std::stable_sort(_sources.begin(), _sources.end(), by_rank);
+    }
+
+    // with affinity memory, every task is spawned with the affinity of the thread that ran it in the previous replay
+    // (see cont_graph::set_affinity_memory.) a static schedule has its own affinities, so this only applies to dynamic replays.
+    void set_affinity_memory(bool enabled)
+    {
+        _affinities.assign(enabled ? _payloads.size() : 0, 0);
+    }
+
+    // lets the given transient conts of the graph share memory, from the measurements of the last replay_and_measure(),
+    // the way a render graph aliases the memory of its transient resources. two conts can share memory if every consumer of one
+    // comes before the producer of the other in the graph, whatever the order the tasks run in, since the value of the first one
+    // isn't needed anymore by the time the second one gets a value. a cont whose producer wasn't measured (because it's set ready
+    // from outside of the graph, or from a task the measurements couldn't attribute) has no known place in the graph,
+    // so it keeps memory of its own. a cont without consumers in the graph can take memory over, but nothing takes its memory over
+    // after it, since its value may be needed after the graph ran. returns how many bytes the shared memory takes.
+    size_t alias_storage(transient_cont_base* const* conts, int num_conts)
+    {
+        assert(_measured);
+
+        release_storage();
+
+        uint32_t num_tasks = (uint32_t)_payloads.size();
+        task_ranks r = rank_tasks();
+
+        std::vector<uint32_t> position(num_tasks);
+        for (uint32_t i = 0; i < num_tasks; i++)
+        {
+            position[r.order[i]] = i;
+        }
+
+        std::unordered_map<cont_base*, uint32_t> indices;
+        for (uint32_t c = 0; c < (uint32_t)_conts.size(); c++)
+        {
+            indices.emplace(_conts[c], c);
+        }
+
+        // the conts with a known producer, in the order their producers come in the graph,
+        // so every slot only ever has to be checked against its last cont.
+        std::vector<std::pair<transient_cont_base*, uint32_t>> transients;
+        for (int i = 0; i < num_conts; i++)
+        {
+            auto found = indices.find(conts[i]);
+            assert(found != indices.end());
+            if (_producers[found->second] >= 0)
+            {
+                transients.emplace_back(conts[i], found->second);
+            }
+        }
+        std::stable_sort(transients.begin(), transients.end(), [&](const std::pair<transient_cont_base*, uint32_t>& a, const std::pair<transient_cont_base*, uint32_t>& b) {
+            return position[_producers[a.second]] < position[_producers[b.second]];
+        });
+
+        // the lifetime of every cont in the topological order, from its first to its last consumer.
+        std::vector<uint32_t> first_use(transients.size(), num_tasks);
+        std::vector<uint32_t> last_use(transients.size(), 0);
+        for (size_t i = 0; i < transients.size(); i++)
+        {
+            uint32_t c = transients[i].second;
+            for (uint32_t k = _consumer_offsets[c]; k != _consumer_offsets[c + 1]; k++)
+            {
+                first_use[i] = std::min(first_use[i], position[_consumers[k]]);
+                last_use[i] = std::max(last_use[i], position[_consumers[k]]);
+            }
+        }
+
+        // the smallest slot that's big enough fits best, or else the biggest one, which grows the least.
+        auto fits_better = [](size_t a, size_t b, size_t size) {
+            if ((a >= size) != (b >= size))
+            {
+                return a >= size;
+            }
+            return a >= size ? a < b : a > b;
+        };
+
+        // the ancestors of a producer are found by searching backwards from it, latest task first in the topological order,
+        // which finds all of them down to any position. the slots are tried from the one whose last cont is used latest,
+        // which needs the shortest search, until one is big enough, and the search gives up after a bounded number of tasks
+        // (the slots it doesn't get to just aren't shared with this cont.) that keeps the analysis linear in memory,
+        // where the reachability of every pair of tasks would be quadratic.
+        const size_t max_search = 4096;
+        std::vector<uint32_t> visited(num_tasks, 0);
+        uint32_t stamp = 0;
+        std::priority_queue<uint32_t> frontier;
+        std::vector<size_t> candidates;
+
+        // the cont that each slot got last, or -1 if no other cont may follow it there.
+        std::vector<int> last_in_slot;
+        std::vector<size_t> slot_of(transients.size());
+        std::vector<size_t> slot_sizes;
+        for (size_t i = 0; i < transients.size(); i++)
+        {
+            uint32_t c = transients[i].second;
+            uint32_t producer = (uint32_t)_producers[c];
+            size_t size = transients[i].first->size();
+
+            // the slots whose last cont is done with in the topological order, which it has to be in any order.
+            candidates.clear();
+            for (size_t s = 0; s < last_in_slot.size(); s++)
+            {
+                if (last_in_slot[s] >= 0 && last_use[last_in_slot[s]] < position[producer])
+                {
+                    candidates.push_back(s);
+                }
+            }
+            std::sort(candidates.begin(), candidates.end(), [&](size_t a, size_t b) {
+                return first_use[last_in_slot[a]] > first_use[last_in_slot[b]];
+            });
+
+            int best_slot = -1;
+            stamp++;
+            frontier = std::priority_queue<uint32_t>();
+            frontier.push(position[producer]);
+            size_t searched = 0;
+            for (size_t s : candidates)
+            {
+                // every ancestor from the first consumer of the last cont of the slot on is visited once the search gets that far,
+                // since the tasks between them come in between in the topological order too.
+                uint32_t bound = first_use[last_in_slot[s]];
+                while (!frontier.empty() && frontier.top() >= bound && searched < max_search)
+                {
+                    uint32_t t = r.order[frontier.top()];
+                    frontier.pop();
+                    searched++;
+
+                    for (uint32_t p : r.predecessors[t])
+                    {
+                        if (visited[p] != stamp)
+                        {
+                            visited[p] = stamp;
+                            frontier.push(position[p]);
+                        }
+                    }
+                }
+                if (!frontier.empty() && frontier.top() >= bound)
+                {
+                    break;
+                }
+
+                uint32_t previous = transients[last_in_slot[s]].second;
+                bool done_before = true;
+                for (uint32_t k = _consumer_offsets[previous]; k != _consumer_offsets[previous + 1] && done_before; k++)
+                {
+                    done_before = visited[_consumers[k]] == stamp;
+                }
+
+                if (done_before && (best_slot < 0 || fits_better(slot_sizes[s], slot_sizes[best_slot], size)))
+                {
+                    best_slot = (int)s;
+                    if (slot_sizes[s] >= size)
+                    {
+                        break;
+                    }
+                }
+            }
+
+            if (best_slot < 0)
+            {
+                best_slot = (int)last_in_slot.size();
+                last_in_slot.push_back(-1);
+                slot_sizes.push_back(0);
+            }
+
+            bool has_consumers = _consumer_offsets[c] != _consumer_offsets[c + 1];
+            last_in_slot[best_slot] = has_consumers ? (int)i : -1;
+            slot_sizes[best_slot] = std::max(slot_sizes[best_slot], size);
+            slot_of[i] = (size_t)best_slot;
+        }
+
+        size_t total = 0;
+        for (size_t size : slot_sizes)
+        {
+            _slots.emplace_back(new transient_cont_base::storage_slot());
+            _slots.back()->memory = tbb::cache_aligned_allocator<char>().allocate(size);
+            _slots.back()->size = size;
+            total += size;
+        }
+
+        for (size_t i = 0; i < transients.size(); i++)
+        {
+            transient_cont_base* t = transients[i].first;
+            t->discard();
+            t->free_own_memory();
+            t->_slot = _slots[slot_of[i]].get();
+            t->_graph = this;
+            t->_graph_index = _transients.size();
+            _transients.push_back(t);
+        }
+
+        return total;
+    }
+
+    // called by a transient cont that's destroyed while it shares memory in this graph. the graph can't be replayed after that,
+    // since the cont is still one of its conts, but it can still release its storage, or be destroyed.
+    void forget_transient(transient_cont_base* t)
+    {
+        transient_cont_base* last = _transients.back();
+        _transients[t->_graph_index] = last;
+        last->_graph_index = t->_graph_index;
+        _transients.pop_back();
+    }
+
+    // gives the transient conts memory of their own again. their values are gone.
+    void release_storage()
+    {
+        for (transient_cont_base* t : _transients)
+        {
+            t->discard();
+            t->_slot = &t->_own_slot;
+            t->_graph = NULL;
+        }
+        _transients.clear();
+
+        for (std::unique_ptr<transient_cont_base::storage_slot>& slot : _slots)
+        {
+            tbb::cache_aligned_allocator<char>().deallocate(slot->memory, slot->size);
+        }
+        _slots.clear();
+    }
+};
+
+inline transient_cont_base::~transient_cont_base()
+{
+    discard();
+
+    if (_slot->occupant == this)
+    {
+        _slot->occupant = NULL;
+    }
+
+    if (_graph != NULL)
+    {
+        _graph->forget_transient(this);
+    }
+
+    free_own_memory();
+}
@@ -0,0 +1,704 @@
+// conts: values that tasks wait for without blocking, and the machinery that spawns a task once all of its conts are ready.
+
+#pragma once
+
+// local task_scheduler_observers (which observe a single arena) are still a preview feature in this version of TBB,
+// and the macro has to come before the first TBB header, so it's defined here, where every other header starts.
+#define TBB_PREVIEW_LOCAL_OBSERVER 1
+
+#include <tbb/task.h>
+#include <tbb/task_arena.h>
+
+#include <cassert>
+#include <atomic>
+#include <array>
+#include <utility>
+#include <new>
+#include <algorithm>
+
+// node in a linked list of tasks that depend on a cont.
+// aligned so that the three low bits of a pointer to it are free for the state of the cont (see cont_base::_head.)
+struct alignas(8) cont_node
+{
+    tbb::task* task;
+    cont_node* next;
+
+    // if set, this is called instead of decrementing the task's reference count when the cont becomes ready.
+    // it lets something other than the task itself sit between the cont and the task (like the nodes of a fan-in tree.)
+    // affinity is what the cont asks its successors to be spawned with (see cont_base::successor_affinity), or 0,
+    // and the hook passes it on to the task it spawns in the end.
+    void (*notify)(cont_node* node, tbb::task::affinity_id affinity) = NULL;
+    void* context = NULL;
+
+    // the arena the successor registered from, which it's spawned into when the cont becomes ready. NULL means wherever that happens.
+    tbb::task_arena* arena = NULL;
+};
+
+// the task_arena the current thread works in, as far as the arenas that keep track of it know (see arena_tracker), or NULL for the others.
+inline tbb::task_arena*& current_arena()
+{
+    static thread_local tbb::task_arena* arena = NULL;
+    return arena;
+}
+
+// spawns the task in the given arena: directly if the current thread works in it (or if no arena is given), otherwise by enqueueing it there.
+inline void spawn_in_arena(tbb::task& t, tbb::task_arena* arena)
+{
+    if (arena == NULL || arena == current_arena())
+    {
+        tbb::task::spawn(t);
+        return;
+    }
+
+    tbb::task* task = &t;
+    arena->enqueue([task] { tbb::task::spawn(*task); });
+}
+
+// like spawn_in_arena, but the tasks are held back until flush() (or the destructor), so that every other arena gets all of its tasks
+// in a single enqueue, no matter how many tasks there are. the tasks for the current arena are spawned together as one task_list,
+// which this thread then runs in the order they were given (a thread runs the tasks it spawned one by one last in, first out.)
+class arena_spawn_batch
+{
+    // the tasks of a batch are held inline, and carried by value by the functor enqueued into the arena, so batching doesn't allocate.
+    // a batch that fills up is sent early, and the next tasks for its arena start a new one.
+    struct batch
+    {
+        tbb::task_arena* arena;
+        std::array<tbb::task*, 8> tasks;
+        int num_tasks;
+    };
+
+    // a cont rarely releases tasks into more than a couple of arenas, so a few batches are enough before flushing early.
+    std::array<batch, 4> _batches;
+    int _num_batches = 0;
+
+    tbb::task_list _local;
+    bool _any_local = false;
+
+    static void send(batch& b)
+    {
+        std::array<tbb::task*, 8> tasks = b.tasks;
+        int num_tasks = b.num_tasks;
+        b.arena->enqueue([tasks, num_tasks] {
+            tbb::task_list list;
+            for (int i = 0; i < num_tasks; i++)
+            {
+                list.push_back(*tasks[i]);
+            }
+            tbb::task::spawn(list);
+        });
+        b.num_tasks = 0;
+    }
+
+public:
+    arena_spawn_batch() = default;
+
+    arena_spawn_batch(const arena_spawn_batch&) = delete;
+    arena_spawn_batch& operator=(const arena_spawn_batch&) = delete;
+
+    ~arena_spawn_batch()
+    {
+        flush();
+    }
+
+    void spawn(tbb::task& t, tbb::task_arena* arena)
+    {
+        if (arena == NULL || arena == current_arena())
+        {
+            _local.push_back(t);
+            _any_local = true;
+            return;
+        }
+
+        for (int i = 0; i < _num_batches; i++)
+        {
+            batch& b = _batches[i];
+            if (b.arena == arena)
+            {
+                if (b.num_tasks == (int)b.tasks.size())
+                {
+                    send(b);
+                }
+                b.tasks[b.num_tasks++] = &t;
+                return;
+            }
+        }
+
+        if (_num_batches == (int)_batches.size())
+        {
+            flush();
+        }
+
+        _batches[_num_batches].arena = arena;
+        _batches[_num_batches].tasks[0] = &t;
+        _batches[_num_batches].num_tasks = 1;
+        _num_batches++;
+    }
+
+    void flush()
+    {
+        for (int i = 0; i < _num_batches; i++)
+        {
+            send(_batches[i]);
+        }
+        _num_batches = 0;
+
+        if (_any_local)
+        {
+            tbb::task::spawn(_local);
+            _any_local = false;
+        }
+    }
+};
+
+// tasks with more conts than this combine their inputs through a fan-in tree,
+// instead of having every cont decrement the task's reference count directly.
+const int cont_fan_in_threshold = 64;
+
+// maximum number of inputs combined by a single node of a fan-in tree.
+const int cont_fan_in_arity = 16;
+
+// node of a fan-in tree. each node counts down its own inputs on its own cache line,
+// and only the last input to arrive is passed on to the parent node (or to the task, at the root of the tree.)
+struct alignas(64) cont_fan_in
+{
+    std::atomic<int> count;
+    cont_fan_in* parent;
+    tbb::task* task;
+    tbb::task_arena* arena;
+};
+
+// counts the given number of inputs into a fan-in node, and walks up the tree for as long as that completes nodes.
+// when the root completes, all inputs have arrived, so it's treated like one input of the task.
+inline void fan_in_arrive(cont_fan_in* f, int num_inputs = 1, tbb::task::affinity_id affinity = 0)
+{
+    while (f->count.fetch_sub(num_inputs, std::memory_order_acq_rel) == num_inputs)
+    {
+        if (f->parent == NULL)
+        {
+            if (f->task->decrement_ref_count() == 0)
+            {
+                if (affinity != 0)
+                {
+                    f->task->set_affinity(affinity);
+                }
+                spawn_in_arena(*f->task, f->arena);
+            }
+            return;
+        }
+
+        f = f->parent;
+        num_inputs = 1;
+    }
+}
+
+// number of fan-in nodes needed to combine the given number of conts, or zero if they don't need a fan-in tree.
+inline int fan_in_tree_size(int num_conts)
+{
+    if (num_conts <= cont_fan_in_threshold)
+    {
+        return 0;
+    }
+
+    int size = 0;
+    int level_width = num_conts;
+    do
+    {
+        level_width = (level_width + cont_fan_in_arity - 1) / cont_fan_in_arity;
+        size += level_width;
+    } while (level_width > 1);
+
+    return size;
+}
+
+// order in which set_ready() notifies the successors of a cont.
+enum class notify_order
+{
+    // the successor that registered last is notified first, which is the order of the linked list.
+    last_registered_first,
+
+    // successors are notified in the order they registered, for when the first consumers are the most latency-sensitive.
+    first_registered_first
+};
+
+// where the successors of a cont are spawned.
+enum class cont_affinity
+{
+    // wherever they become ready.
+    none,
+
+    // tagged with the affinity of the thread that set the cont ready, so that the data it just wrote is likely still in its caches.
+    // this matters most for successors that find the cont already ready, which would otherwise run wherever they registered.
+    producer
+};
+
+// affinity id of the current thread (its slot in the arena, plus one), or 0 (no affinity) if it isn't in an arena.
+inline tbb::task::affinity_id current_affinity_id()
+{
+    int index = tbb::this_task_arena::current_thread_index();
+    return index >= 0 ? (tbb::task::affinity_id)(index + 1) : 0;
+}
+
+// base class for working with conts (encapsulates tricky atomic code)
+class cont_base
+{
+    // head of the linked list of successors queued on this cont.
+    // the least significant bit is set once the cont is ready. the second one is set while the head holds the node of the producer
+    // of a lazy cont instead of a list (see set_lazy_producer), which the first successor to register takes out and starts.
+    // the third one is set along with the first if the cont was pruned rather than set ready (see set_pruned.)
+    std::atomic<cont_node*> _head = NULL;
+
+    cont_affinity _affinity = cont_affinity::none;
+
+    // with cont_affinity::producer, the affinity of the thread that set the cont ready. it's published by setting the cont ready.
+    tbb::task::affinity_id _producer_affinity = 0;
+
+    // if set, the successors of the cont run in this arena, like the arena of the NUMA node where the cont's data lives.
+    tbb::task_arena* _home_arena = NULL;
+
+public:
+    cont_base() = default;
+
+    cont_base(const cont_base&) = delete;
+    cont_base& operator=(const cont_base&) = delete;
+    cont_base(cont_base&&) = delete;
+    cont_base& operator=(cont_base&&) = delete;
+
+    ~cont_base()
+    {
+        drop_lazy_producer();
+    }
+
+    // return true if this cont has been set_ready()
+    bool is_ready() const
+    {
+        return ((intptr_t)_head.load(std::memory_order_acquire) & 1) != 0;
+    }
+
+    // only valid while the cont isn't ready.
+    void set_affinity_mode(cont_affinity affinity)
+    {
+        _affinity = affinity;
+    }
+
+    // only valid while the cont isn't ready.
+    void set_home_arena(tbb::task_arena* arena)
+    {
+        _home_arena = arena;
+    }
+
+    tbb::task_arena* home_arena() const
+    {
+        return _home_arena;
+    }
+
+    // the affinity the successors of this cont should be spawned with, or 0 for none. only valid once the cont is ready.
+    tbb::task::affinity_id successor_affinity() const
+    {
+        return _producer_affinity;
+    }
+
+    // true if the cont was pruned instead of set ready.
+    bool is_pruned() const
+    {
+        return ((intptr_t)_head.load(std::memory_order_acquire) & 4) != 0;
+    }
+
+    // sends this cont to all successors in the linked list.
+    void set_ready(notify_order order = notify_order::last_registered_first)
+    {
+        resolve(order, 1);
+    }
+
+    // instead of set_ready(), for a cont that won't be produced because its producer didn't take the branch of the graph that needs it.
+    // the successors that can be pruned (see cont_task_group::with_spawner::or_prune) are skipped without running, and prune their own
+    // outputs in turn, so the whole branch is dropped at the cost of one notification per edge. other successors run as if the cont
+    // was ready, and can find out with is_pruned().
+    void set_pruned(notify_order order = notify_order::last_registered_first)
+    {
+        resolve(order, 1 | 4);
+    }
+
+private:
+    // closes the list of successors with the given state bits, and notifies them.
+    void resolve(notify_order order, intptr_t state)
+    {
+        assert(!is_ready());
+
+        _producer_affinity = _affinity == cont_affinity::producer ? current_affinity_id() : 0;
+
+        cont_node* old_head;
+
+        // mark the cont as ready atomically. readiness is indicated by the least significant bit of the head pointer.
+        for (;;)
+        {
+            old_head = _head.load(std::memory_order_acquire);
+            cont_node* ready_head = (cont_node*)state;
+            if (((intptr_t)old_head & 2) == 0)
+            {
+                ready_head = (cont_node*)((intptr_t)old_head | state);
+            }
+
+            if (_head.compare_exchange_weak(old_head, ready_head, std::memory_order_acq_rel, std::memory_order_relaxed))
+            {
+                // If the CAS failed, that means a successor just added themselves to the list,
+                // since that successor thought this cont was not ready yet. (or possibly it was a spurious wakeup.)
+                // If it succeeded, then the cont can notify all successors that have been queued so far.
+                break;
+            }
+        }
+
+        // a lazy cont that got set ready some other way before anybody needed it has no successors, and its producer won't be needed anymore.
+        if ((intptr_t)old_head & 2)
+        {
+            tbb::task::destroy(*((cont_node*)((intptr_t)old_head & ~(intptr_t)3))->task);
+            return;
+        }
+
+        // the list is closed now, so nobody else touches it anymore, and it can be reversed in place.
+        // the nodes are still owned by their successors, but none of them can run (and free its node) before it gets notified.
+        if (order == notify_order::first_registered_first)
+        {
+            cont_node* reversed = NULL;
+            while (old_head != NULL)
+            {
+                cont_node* next = old_head->next;
+                old_head->next = reversed;
+                reversed = old_head;
+                old_head = next;
+            }
+            old_head = reversed;
+        }
+
+        // successors released into other arenas than this one are enqueued there together at the end.
+        arena_spawn_batch spawns;
+
+        // Notify all successors that have been queued
+        for (cont_node* node = old_head; node != NULL; )
+        {
+            // the node belongs to the successor, which might run (and free the node) as soon as it's notified,
+            // so the next pointer has to be read before that.
+            cont_node* next = node->next;
+
+            if (node->notify != NULL)
+            {
+                node->notify(node, _producer_affinity);
+            }
+            else if (node->task->decrement_ref_count() == 0)
+            {
+                // this was the last missing input, so the task can now be spawned.
+                if (_producer_affinity != 0)
+                {
+                    node->task->set_affinity(_producer_affinity);
+                }
+                // a home arena overrides the arena the successor registered from.
+                spawns.spawn(*node->task, _home_arena != NULL ? _home_arena : node->arena);
+            }
+
+            node = next;
+        }
+    }
+
+    // starts the producer of a lazy cont that was taken out of its head: through the notify hook of its node if it has one
+    // (which spawns the task itself, once it's done whatever it has to do first), or by spawning it.
+    static void start_lazy_producer(cont_node* producer)
+    {
+        if (producer->notify != NULL)
+        {
+            producer->notify(producer, 0);
+        }
+        else
+        {
+            tbb::task::spawn(*producer->task);
+        }
+    }
+
+    // the producer of a lazy cont that nobody needed never runs.
+    void drop_lazy_producer()
+    {
+        if (cont_node* producer = take_lazy_producer())
+        {
+            tbb::task::destroy(*producer->task);
+        }
+    }
+
+public:
+    // makes the cont lazy: the producer task (producer->task, which sets the cont ready) is only started once the cont is needed,
+    // when the first successor registers or when somebody calls demand(). if the cont goes away (or is reset) before that,
+    // the producer is destroyed without running. the node has to stay around until then, like in the producer task itself.
+    // only valid while the cont isn't ready and has no successors.
+    void set_lazy_producer(cont_node* producer)
+    {
+        assert(((intptr_t)producer & 3) == 0);
+        _head.store((cont_node*)((intptr_t)producer | 2), std::memory_order_release);
+    }
+
+    // starts the producer of a lazy cont if it didn't run yet, for when the cont is needed without registering a successor,
+    // like right before waiting for it some other way.
+    void demand()
+    {
+        if (cont_node* producer = take_lazy_producer())
+        {
+            start_lazy_producer(producer);
+        }
+    }
+
+    // takes the node of the producer out of a lazy cont that nobody needed yet, or returns NULL.
+    cont_node* take_lazy_producer()
+    {
+        cont_node* head = _head.load(std::memory_order_acquire);
+        while ((intptr_t)head & 2)
+        {
+            if (_head.compare_exchange_weak(head, NULL, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                return (cont_node*)((intptr_t)head & ~(intptr_t)3);
+            }
+        }
+        return NULL;
+    }
+
+    // makes the cont not ready anymore, so it can be used again. the producer of a lazy cont that wasn't needed is destroyed.
+    // only valid once set_ready() has returned, and while nobody is trying to register as a successor.
+    void reset()
+    {
+        drop_lazy_producer();
+        _head.store(NULL, std::memory_order_release);
+    }
+
+    // makes the cont not ready anymore, with the given (prebuilt) linked list of successors already registered.
+    // same restrictions as reset(), and the nodes of the list have to stay around until the cont is set ready.
+    void rearm(cont_node* head)
+    {
+        drop_lazy_producer();
+        _head.store(head, std::memory_order_release);
+    }
+
+    // Tries adding the given task to the cont's successor linked list using the given linked list node.
+    // This fails (and returns false) if the successor queue has already been closed because the cont has already been set.
+    // If it succeeds (and returns true), then the passed-in task was successfully added to the linked list.
+    bool try_register_successor(tbb::task* t, cont_node* c)
+    {
+        cont_node* new_head = c;
+        new_head->task = t;
+        new_head->arena = current_arena();
+
+        for (;;)
+        {
+            cont_node* old_head = _head.load(std::memory_order_acquire);
+
+            if ((intptr_t)old_head & 1)
+            {
+                // cont was already set, so can't register yourself.
+                // the caller should use this knowledge to know that they can just read from the cont without queueing themselves.
+                return false;
+            }
+
+            // the first successor of a lazy cont starts the list, and sets off the producer that was waiting in the head.
+            cont_node* producer = NULL;
+            if ((intptr_t)old_head & 2)
+            {
+                producer = (cont_node*)((intptr_t)old_head & ~(intptr_t)3);
+                new_head->next = NULL;
+            }
+            else
+            {
+                new_head->next = old_head;
+            }
+
+            // It's possible for the successor notification queue to be closed concurrently while we're trying to add ourselves to it.
+            // It's also possible for another successor to have registered themselves concurrently and beat this successor to the punch.
+            if (_head.compare_exchange_weak(old_head, new_head, std::memory_order_acq_rel, std::memory_order_relaxed))
+            {
+                if (producer != NULL)
+                {
+                    start_lazy_producer(producer);
+                }
+                return true;
+            }
+        }
+    }
+};
+
+// Associates data to a cont, std::optional-style.
+// TODO: Just replace all of this with std::optional?
+template<class T>
+class cont : public cont_base
+{
+    bool _has_value = false;
+    std::aligned_storage_t<sizeof(T), alignof(T)> _storage;
+
+public:
+    cont() = default;
+
+    cont(const cont&) = delete;
+    cont& operator=(const cont&) = delete;
+    cont(cont&&) = delete;
+    cont& operator=(cont&&) = delete;
+
+    ~cont()
+    {
+        if (_has_value)
+        {
+            (**this).~T();
+        }
+    }
+
+    T* operator->()
+    {
+        return reinterpret_cast<T*>(&_storage);
+    }
+
+    const T* operator->() const
+    {
+        return reinterpret_cast<const T*>(&_storage);
+    }
+
+    T& operator*()
+    {
+        return *reinterpret_cast<T*>(&_storage);
+    }
+
+    const T& operator*() const
+    {
+        return *reinterpret_cast<const T*>(&_storage);
+    }
+
+    template<class... Args>
+    void emplace(Args&&... args)
+    {
+        assert(!is_ready());
+
+        if (_has_value)
+        {
+            (**this).~T();
+        }
+
+        new (&_storage) T(std::forward<Args>(args)...);
+
+        _has_value = true;
+    }
+};
+
+// spawns the given task when all the "conts" are ready. There must be a linked list node supplied for each cont.
+inline void spawn_when_ready(tbb::task& t, cont_base** conts, cont_node* nodes, int num_conts)
+{
+    // +1 reference count for each missing argument
+    // the task is only spawned when the reference count is zero,
+    // so that means it gets decremented once for each input that gets filled in.
+    t.add_ref_count(num_conts);
+
+    int num_inputs_already_ok = 0;
+    tbb::task::affinity_id affinity = 0;
+    tbb::task_arena* arena = NULL;
+
+    for (size_t cont_i = 0; cont_i < num_conts; cont_i++)
+    {
+        cont_base* c = conts[cont_i];
+
+        // try registering the task as a successor of each cont, so the task will get notified (and its refcount decremented) when the cont becomes available
+        if (!c->try_register_successor(&t, &nodes[cont_i]))
+        {
+            // if we can't subscribe a successor to the cont, that means the cont is already set.
+            // in other words, that input is already ready to go, and we don't need to wait for a notification about it.
+            num_inputs_already_ok++;
+
+            if (affinity == 0)
+            {
+                affinity = c->successor_affinity();
+            }
+            if (arena == NULL)
+            {
+                arena = c->home_arena();
+            }
+        }
+    }
+
+    // incorporate the inputs that already okay into the reference count.
+    // if the reference count hits zero, that means all inputs are satisfied and the task can be spawned.
+    // a task without any conts has nothing to wait for, so it's spawned right away.
+    if (num_inputs_already_ok > 0 || num_conts == 0)
+    {
+        if (t.add_ref_count(-num_inputs_already_ok) == 0)
+        {
+            if (affinity != 0)
+            {
+                t.set_affinity(affinity);
+            }
+            spawn_in_arena(t, arena);
+        }
+    }
+}
+
+// notify hook of the cont_nodes registered by a fan-in tree. the context is the leaf that counts the input.
+inline void notify_fan_in(cont_node* node, tbb::task::affinity_id affinity)
+{
+    fan_in_arrive((cont_fan_in*)node->context, 1, affinity);
+}
+
+// spawns the given task when all the "conts" are ready, like above.
+// if there are many conts, they are combined through a fan-in tree first, so producers don't all hammer the task's reference count.
+// fan_ins must have room for fan_in_tree_size(num_conts) nodes.
+inline void spawn_when_ready(tbb::task& t, cont_base** conts, cont_node* nodes, cont_fan_in* fan_ins, int num_conts)
+{
+    if (fan_in_tree_size(num_conts) == 0)
+    {
+        spawn_when_ready(t, conts, nodes, num_conts);
+        return;
+    }
+
+    // lay out the tree one level at a time, starting from the leaves (which count conts) up to the root.
+    // every other node counts its children, and each level is stored right after the one below it.
+    int level_begin = 0;
+    int level_width = (num_conts + cont_fan_in_arity - 1) / cont_fan_in_arity;
+    int num_level_inputs = num_conts;
+
+    for (;;)
+    {
+        int parent_level_begin = level_begin + level_width;
+
+        for (int i = 0; i < level_width; i++)
+        {
+            cont_fan_in& f = fan_ins[level_begin + i];
+            f.count.store(std::min(cont_fan_in_arity, num_level_inputs - i * cont_fan_in_arity), std::memory_order_relaxed);
+            f.parent = level_width == 1 ? NULL : &fan_ins[parent_level_begin + i / cont_fan_in_arity];
+            f.task = &t;
+            f.arena = current_arena();
+        }
+
+        if (level_width == 1)
+        {
+            break;
+        }
+
+        num_level_inputs = level_width;
+        level_begin = parent_level_begin;
+        level_width = (level_width + cont_fan_in_arity - 1) / cont_fan_in_arity;
+    }
+
+    // the whole tree only counts as a single input of the task.
+    t.add_ref_count(1);
+
+    // conts are registered one leaf at a time, so the inputs that are already ready can be counted into their leaf all at once.
+    for (int leaf_begin = 0; leaf_begin < num_conts; leaf_begin += cont_fan_in_arity)
+    {
+        cont_fan_in* leaf = &fan_ins[leaf_begin / cont_fan_in_arity];
+        int leaf_end = std::min(leaf_begin + cont_fan_in_arity, num_conts);
+        int num_inputs_already_ok = 0;
+
+        for (int cont_i = leaf_begin; cont_i < leaf_end; cont_i++)
+        {
+            nodes[cont_i].notify = &notify_fan_in;
+            nodes[cont_i].context = leaf;
+
+            if (!conts[cont_i]->try_register_successor(&t, &nodes[cont_i]))
+            {
+                num_inputs_already_ok++;
+            }
+        }
+
+        if (num_inputs_already_ok > 0)
+        {
+            fan_in_arrive(leaf, num_inputs_already_ok);
+        }
+    }
+}
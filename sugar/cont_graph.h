@@ -0,0 +1,462 @@
+// graphs of tasks and conts captured once from a cont_task_group, and replayed as often as needed.
+
+#pragma once
+
+#include "cont.h"
+
+#include <tbb/task.h>
+
+#include <cassert>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+#include <typeinfo>
+#include <utility>
+#include <type_traits>
+#include <new>
+#include <algorithm>
+#include <stdexcept>
+
+// a DAG of tasks and conts captured from a cont_task_group (see cont_task_group::begin_capture), that can then be replayed many times.
+// replays don't register successors or copy closures: the closures are kept from the capture, and every cont gets its list
+// of successors prebuilt, which replay() installs with a single store before spawning anything. a task that becomes ready
+// only costs a small runner task from TBB's free lists, which the scheduler frees once it ran.
+// conts that are consumed by the graph and weren't ready when they were captured are made not ready again at every replay,
+// so they have to be set ready once during every replay. so are the outputs of the graph, which have to be declared
+// (see add_output), since nothing in the graph waits for them. the closures of a captured graph must not throw.
+//
+// capturing again into a graph that already has tasks patches it instead of starting over: tasks are matched by key
+// (the key given with cont_task_group::capture_key, or else their position among the tasks captured without one),
+// tasks that weren't captured again are removed, and only the successor lists of the conts whose consumers changed are rebuilt.
+// conts that no task consumes anymore are forgotten, unless they're declared as outputs again. once the capture that left a cont out
+// has ended, the cont can be destroyed, but it keeps the state of the last replay: it has to be reset before a later capture uses it again.
+class cont_graph
+{
+    friend class compact_graph;
+
+public:
+    static const size_t no_key = SIZE_MAX;
+
+    // the keys given to tasks are tagged with this bit, so they never match the positions of the tasks without one.
+    // so it can't be part of a key itself.
+    static const size_t explicit_key_bit = ~(SIZE_MAX >> 1);
+
+private:
+    // a task of the graph, which keeps its closure from one replay to the next. it isn't a tbb::task itself,
+    // so the scheduler never holds on to it after it ran: once the frame is done, the graph can be replayed or changed right away.
+    class graph_task
+    {
+    public:
+        cont_graph* graph = NULL;
+        size_t key = 0;
+
+        // the capture this task was last seen in.
+        int pass = 0;
+
+        // indices of the conts this task waits for.
+        std::vector<int> inputs;
+
+        // how many of the inputs are still missing in the current replay.
+        std::atomic<int> pending;
+
+        // the thread that ran the task last, which it goes back to in the next replay with set_affinity_memory(true).
+        tbb::task::affinity_id last_affinity = 0;
+
+        graph_task()
+            : pending(0)
+        { }
+
+        virtual ~graph_task() = default;
+
+        virtual void run() = 0;
+
+        // replaces the closure with the one pointed to by fun (moving from it), if it has the same type.
+        virtual bool replace(const std::type_info& type, void* fun) = 0;
+    };
+
+    // runs a task of the graph once it's ready. it's an additional child of the frame, which also holds one reference for every task
+    // of the graph until it ran, so the frame is only done once the last runner is freed by the scheduler.
+    class runner_task : public tbb::task
+    {
+        graph_task* _task;
+
+    public:
+        explicit runner_task(graph_task* t)
+            : _task(t)
+        { }
+
+        tbb::task* execute() override
+        {
+            _task->last_affinity = current_affinity_id();
+            _task->run();
+            parent()->decrement_ref_count();
+            return NULL;
+        }
+    };
+
+    template<class TaskFun>
+    class graph_task_runner : public graph_task
+    {
+        TaskFun mfun;
+
+    public:
+        template<class F>
+        explicit graph_task_runner(F&& fun)
+            : mfun(std::forward<F>(fun))
+        { }
+
+        void run() override
+        {
+            mfun();
+        }
+
+        bool replace(const std::type_info& type, void* fun) override
+        {
+            // the old closure has to be destroyed before the new one is moved in its place, so a move that throws would leave
+            // the task without a closure. for closures that can throw when moved, the graph makes a new task instead.
+            if (type != typeid(TaskFun) || !std::is_nothrow_move_constructible<TaskFun>::value)
+            {
+                return false;
+            }
+
+            mfun.~TaskFun();
+            new (&mfun) TaskFun(std::move(*(TaskFun*)fun));
+            return true;
+        }
+    };
+
+    struct cont_record
+    {
+        cont_base* cont;
+        std::vector<graph_task*> consumers;
+
+        // prebuilt successor list of the cont, with one node for each consumer.
+        std::vector<cont_node> nodes;
+
+        // set when the consumers changed since the nodes were built.
+        bool dirty = false;
+
+        // the capture the cont was last declared as an output of the graph in (see add_output.)
+        int output_pass = 0;
+    };
+
+    // replays can't be cancelled from the outside, since the tasks of a cancelled replay wouldn't set their outputs.
+    tbb::task_group_context _context;
+
+    // the task that replay() waits on. every task of the graph holds one reference until it ran.
+    tbb::task* _frame;
+
+    std::vector<graph_task*> _tasks;
+    std::unordered_map<size_t, graph_task*> _tasks_by_key;
+    std::vector<cont_record> _conts;
+    std::unordered_map<cont_base*, int> _cont_indices;
+
+    int _pass = 0;
+    size_t _next_index = 0;
+
+    bool _affinity_memory = false;
+
+    tbb::task& allocate_runner(graph_task& t)
+    {
+        tbb::task& runner = *new (_frame->allocate_additional_child_of(*_frame)) runner_task(&t);
+        runner.set_affinity(_affinity_memory ? t.last_affinity : 0);
+        return runner;
+    }
+
+    // notify hook of the prebuilt nodes. the context is the consumer.
+    // the affinity the cont asks for comes before the one remembered from the previous replay.
+    static void notify(cont_node* node, tbb::task::affinity_id affinity)
+    {
+        graph_task* t = (graph_task*)node->context;
+        if (t->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            tbb::task& runner = t->graph->allocate_runner(*t);
+            if (affinity != 0)
+            {
+                runner.set_affinity(affinity);
+            }
+            tbb::task::spawn(runner);
+        }
+    }
+
+    void link_inputs(graph_task* t)
+    {
+        for (int c : t->inputs)
+        {
+            _conts[c].consumers.push_back(t);
+            _conts[c].dirty = true;
+        }
+    }
+
+    void unlink_inputs(graph_task* t)
+    {
+        for (int c : t->inputs)
+        {
+            std::vector<graph_task*>& consumers = _conts[c].consumers;
+            consumers.erase(std::find(consumers.begin(), consumers.end(), t));
+            _conts[c].dirty = true;
+        }
+    }
+
+    void remove_task(graph_task* t)
+    {
+        unlink_inputs(t);
+
+        _tasks_by_key.erase(t->key);
+        *std::find(_tasks.begin(), _tasks.end(), t) = _tasks.back();
+        _tasks.pop_back();
+
+        delete t;
+    }
+
+public:
+    cont_graph()
+        : _context(tbb::task_group_context::isolated)
+    {
+        _frame = new (tbb::task::allocate_root(_context)) tbb::empty_task();
+    }
+
+    cont_graph(const cont_graph&) = delete;
+    cont_graph& operator=(const cont_graph&) = delete;
+
+    ~cont_graph()
+    {
+        for (graph_task* t : _tasks)
+        {
+            delete t;
+        }
+
+        tbb::task::destroy(*_frame);
+    }
+
+    // starts capturing the graph again. the tasks added until end_capture() replace the ones of the previous capture.
+    void begin_capture()
+    {
+        _pass++;
+        _next_index = 0;
+    }
+
+    // adds a task that runs tfun once all the given conts are ready, or updates the task with the same key from the previous capture.
+    // two tasks of the same capture can't have the same key.
+    template<class TaskFun>
+    void add(TaskFun&& tfun, cont_base* const* conts, int num_conts, size_t key = no_key)
+    {
+        if (key == no_key)
+        {
+            key = _next_index++;
+        }
+        else
+        {
+            assert((key & explicit_key_bit) == 0);
+            key |= explicit_key_bit;
+        }
+
+        // the second task would silently take the place of the first one.
+        auto found = _tasks_by_key.find(key);
+        if (found != _tasks_by_key.end() && found->second->pass == _pass)
+        {
+            throw std::invalid_argument("two tasks of the same capture have the same key");
+        }
+
+        std::vector<int> inputs;
+        for (int i = 0; i < num_conts; i++)
+        {
+            auto found = _cont_indices.find(conts[i]);
+            if (found != _cont_indices.end())
+            {
+                inputs.push_back(found->second);
+                continue;
+            }
+
+            // a cont that is already ready (and not part of the graph yet) is taken as an input that stays satisfied in every replay.
+            if (conts[i]->is_ready())
+            {
+                continue;
+            }
+
+            _cont_indices.emplace(conts[i], (int)_conts.size());
+            inputs.push_back((int)_conts.size());
+            _conts.emplace_back();
+            _conts.back().cont = conts[i];
+        }
+
+        std::decay_t<TaskFun> fun(std::forward<TaskFun>(tfun));
+
+        graph_task* t = NULL;
+        graph_task* replaced = NULL;
+        if (found != _tasks_by_key.end())
+        {
+            t = found->second;
+            if (!t->replace(typeid(fun), &fun))
+            {
+                replaced = t;
+                t = NULL;
+            }
+        }
+
+        if (t == NULL)
+        {
+            // the new task is made before the old one goes away, so the graph still has the old one if that throws.
+            t = new graph_task_runner<decltype(fun)>(std::move(fun));
+            if (replaced != NULL)
+            {
+                remove_task(replaced);
+            }
+
+            t->graph = this;
+            t->key = key;
+            _tasks.push_back(t);
+            _tasks_by_key.emplace(key, t);
+        }
+        else if (t->inputs == inputs)
+        {
+            t->pass = _pass;
+            return;
+        }
+        else
+        {
+            unlink_inputs(t);
+        }
+
+        t->inputs = std::move(inputs);
+        t->pass = _pass;
+        link_inputs(t);
+    }
+
+    // declares a cont that the tasks of the graph set ready, but that no task of the graph waits for, like a result
+    // that the code around replay() reads. it's made not ready again at every replay, like the conts that the graph consumes,
+    // so that its producer can set it again. without that, the second replay would find it still ready from the first one.
+    // like the tasks, the outputs have to be declared again in every capture.
+    void add_output(cont_base* c)
+    {
+        auto found = _cont_indices.find(c);
+        if (found != _cont_indices.end())
+        {
+            _conts[found->second].output_pass = _pass;
+            return;
+        }
+
+        _cont_indices.emplace(c, (int)_conts.size());
+        _conts.emplace_back();
+        _conts.back().cont = c;
+        _conts.back().output_pass = _pass;
+    }
+
+    // removes the tasks that weren't captured again, and rebuilds the successor lists of the conts whose consumers changed.
+    void end_capture()
+    {
+        for (size_t i = 0; i < _tasks.size(); )
+        {
+            if (_tasks[i]->pass != _pass)
+            {
+                remove_task(_tasks[i]);
+            }
+            else
+            {
+                i++;
+            }
+        }
+
+        // the conts that lost all their consumers in this capture (and aren't outputs) aren't rearmed anymore,
+        // since whoever owns them might destroy them, or reuse their memory for another cont, once they're out of the graph.
+        std::vector<int> new_indices(_conts.size(), -1);
+        size_t num_kept = 0;
+        for (size_t c = 0; c < _conts.size(); c++)
+        {
+            if (_conts[c].consumers.empty() && _conts[c].output_pass != _pass)
+            {
+                continue;
+            }
+
+            new_indices[c] = (int)num_kept;
+            if (num_kept != c)
+            {
+                _conts[num_kept] = std::move(_conts[c]);
+            }
+            num_kept++;
+        }
+
+        if (num_kept != _conts.size())
+        {
+            _conts.resize(num_kept);
+
+            for (graph_task* t : _tasks)
+            {
+                for (int& c : t->inputs)
+                {
+                    c = new_indices[c];
+                }
+            }
+
+            _cont_indices.clear();
+            for (size_t c = 0; c < _conts.size(); c++)
+            {
+                _cont_indices.emplace(_conts[c].cont, (int)c);
+            }
+        }
+
+        for (cont_record& c : _conts)
+        {
+            if (!c.dirty)
+            {
+                continue;
+            }
+
+            c.nodes.assign(c.consumers.size(), cont_node());
+            for (size_t i = 0; i < c.nodes.size(); i++)
+            {
+                c.nodes[i].task = NULL;
+                c.nodes[i].notify = notify;
+                c.nodes[i].context = c.consumers[i];
+            }
+            c.dirty = false;
+        }
+    }
+
+    // with affinity memory, every task is spawned with the affinity of the thread that ran it in the previous replay,
+    // like tbb::affinity_partitioner does for the pieces of a range, so that tasks with large working sets find them still in the caches.
+    void set_affinity_memory(bool enabled)
+    {
+        _affinity_memory = enabled;
+    }
+
+    // runs all the tasks of the graph once, and waits for all of them to finish.
+    void replay()
+    {
+        _frame->set_ref_count((int)_tasks.size() + 1);
+
+        // the counts are reset before the conts, since a cont can be set ready from outside of the graph as soon as it's rearmed.
+        for (graph_task* t : _tasks)
+        {
+            t->pending.store((int)t->inputs.size(), std::memory_order_relaxed);
+        }
+
+        // the nodes are linked again every time, since set_ready(notify_order::first_registered_first) reverses the list in place.
+        for (cont_record& c : _conts)
+        {
+            for (size_t i = 0; i < c.nodes.size(); i++)
+            {
+                c.nodes[i].next = i + 1 < c.nodes.size() ? &c.nodes[i + 1] : NULL;
+            }
+            c.cont->rearm(c.nodes.empty() ? NULL : c.nodes.data());
+        }
+
+        tbb::task_list ready_tasks;
+        bool any_ready = false;
+        for (graph_task* t : _tasks)
+        {
+            if (t->inputs.empty())
+            {
+                ready_tasks.push_back(allocate_runner(*t));
+                any_ready = true;
+            }
+        }
+
+        if (any_ready)
+        {
+            tbb::task::spawn(ready_tasks);
+        }
+
+        _frame->wait_for_all();
+    }
+};
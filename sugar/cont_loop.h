@@ -0,0 +1,143 @@
+// loops over graphs of conts, without a barrier between the iterations.
+
+#pragma once
+
+#include "cont_task_group.h"
+#include "shared_cont.h"
+
+#include <utility>
+#include <type_traits>
+#include <memory>
+#include <algorithm>
+#include <exception>
+
+// a loop over a graph of conts, for iterative algorithms that repeat the same steps until they converge, without waiting for
+// every iteration. body(k, prev, next) adds the tasks of iteration k to the group: they read prev (the state after the previous
+// iteration, or the initial state) and eventually set next ready. the decision to stop after iteration k is a cont of its own too,
+// made by a task that runs done(k, state) once the state of iteration k is ready, and after the decision of iteration k - 1.
+// the iterations are unrolled up to depth ahead of the decisions, so up to depth iterations overlap, and the next ones are only added
+// as the decisions come in. when the loop stops, the iterations already added run anyway but their decisions are pruned (see
+// cont_base::set_pruned), and result() becomes ready with the state of the last iteration.
+// the state of the loop is shared by the handle and the decision tasks, so the handle can go away while the loop runs.
+// if done throws, the loop stops there: the result is pruned instead, and error() has the exception. it doesn't go to the group,
+// since cancelling the group would leave the tasks that wait for conts of the cancelled ones (in the loop or not) waiting forever,
+// so the loop can share its group with other work. the tasks that body adds to the group aren't covered by this, and the
+// exceptions they throw do cancel the group as usual.
+// made with make_cont_loop, like auto loop = make_cont_loop<T>(g, depth, body, done).
+template<class T, class Body, class Done>
+class cont_loop
+{
+    struct loop_state
+    {
+        cont_task_group& group;
+        int depth;
+        Body body;
+        Done done;
+
+        // the state and the decision of the last iteration added. only the decision tasks touch them once the loop runs,
+        // and those run one after the other.
+        shared_cont<T> last_state;
+        shared_cont<bool> last_decision;
+
+        shared_cont<T> result;
+        int iterations = 0;
+        std::exception_ptr error;
+
+        template<class B, class D>
+        loop_state(cont_task_group& g, int d, B&& b, D&& f)
+            : group(g)
+            , depth(d)
+            , body(std::forward<B>(b))
+            , done(std::forward<D>(f))
+        { }
+    };
+
+    std::shared_ptr<loop_state> _state;
+
+    static void add_iteration(const std::shared_ptr<loop_state>& s, int k)
+    {
+        shared_cont<T> prev = s->last_state;
+        shared_cont<bool> prev_decision = s->last_decision;
+        shared_cont<T> next;
+        shared_cont<bool> decision;
+        s->last_state = next;
+        s->last_decision = decision;
+
+        s->body(k, prev, next);
+
+        // the task holds on to the conts it waits for, since it still looks at them once they're resolved.
+        s->group.with(next, prev_decision).or_prune(decision).run([s, k, next, decision] {
+            bool stop;
+            try
+            {
+                stop = s->done(k, *next);
+            }
+            catch (...)
+            {
+                // the result is pruned only once the error is in place, since its consumers look at it then.
+                s->error = std::current_exception();
+                s->result.set_pruned();
+                decision.set_pruned();
+                return;
+            }
+
+            if (stop)
+            {
+                s->iterations = k + 1;
+                s->result.emplace(*next);
+                s->result.set_ready();
+                decision.set_pruned();
+                return;
+            }
+
+            // the iteration that replaces this one in the unrolled window has to be added before the next decision can run.
+            add_iteration(s, k + s->depth);
+            decision.set_ready();
+        });
+    }
+
+public:
+    template<class B, class D>
+    cont_loop(cont_task_group& group, int depth, B&& body, D&& done)
+        : _state(std::make_shared<loop_state>(group, std::max(depth, 1), std::forward<B>(body), std::forward<D>(done)))
+    { }
+
+    // starts the loop from the given state. it keeps going in the group on its own, and result() tells when it's over.
+    void run(T initial)
+    {
+        _state->last_state.emplace(std::move(initial));
+        _state->last_state.set_ready();
+
+        // the decisions only start coming in once the whole window is added.
+        shared_cont<bool> start = _state->last_decision;
+        for (int k = 0; k < _state->depth; k++)
+        {
+            add_iteration(_state, k);
+        }
+        start.set_ready();
+    }
+
+    // ready once the loop stopped, with the state after its last iteration, or pruned if done threw.
+    const shared_cont<T>& result() const
+    {
+        return _state->result;
+    }
+
+    // how many iterations the result took. only valid once result() is ready.
+    int iterations() const
+    {
+        return _state->iterations;
+    }
+
+    // the exception that done threw. only valid once result() is pruned.
+    std::exception_ptr error() const
+    {
+        return _state->error;
+    }
+};
+
+template<class T, class Body, class Done>
+cont_loop<T, std::decay_t<Body>, std::decay_t<Done>> make_cont_loop(cont_task_group& group, int depth, Body&& body, Done&& done)
+{
+    return cont_loop<T, std::decay_t<Body>, std::decay_t<Done>>(group, depth, std::forward<Body>(body), std::forward<Done>(done));
+}
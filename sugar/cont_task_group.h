@@ -0,0 +1,741 @@
+// a task_group whose tasks can wait for conts.
+
+#pragma once
+
+#include "counted_task.h"
+#include "range_task.h"
+#include "cont_graph.h"
+#include "graph_pool.h"
+#include "slab_allocator.h"
+#include "shared_cont.h"
+
+#include <tbb/task.h>
+#include <tbb/task_group.h>
+#include <tbb/cache_aligned_allocator.h>
+#include <tbb/task_arena.h>
+#include <tbb/blocked_range.h>
+
+#include <cassert>
+#include <atomic>
+#include <array>
+#include <vector>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <memory>
+#include <new>
+#include <algorithm>
+
+// TBB's scheduler recycles tasks of up to this many bytes (not counting its own prefix) through a free list per thread,
+// and only bigger ones go through its general allocator. a closure whose task stays under this costs nothing more to allocate
+// than the task itself, so it stays in the task even when the group has a pool (see cont_task_group::use_pool.)
+const size_t quick_task_size = 192;
+
+class cont_task_group : public tbb::task_group
+{
+    // continuation of all the tasks that ran in the group since the last wait() (the current "epoch" of the group.)
+    // it holds one extra reference until the epoch gets sealed by completion() or wait(),
+    // and it runs once every task of the epoch has finished, which makes the completion cont ready.
+    // if the group gets cancelled, the drain task is destroyed without running, and prunes the completion cont instead,
+    // so that the tasks of other groups that wait for it don't wait forever.
+    class drain_task : public tbb::task
+    {
+        cont_base* _completion;
+
+    public:
+        explicit drain_task(cont_base* completion)
+            : _completion(completion)
+        { }
+
+        ~drain_task()
+        {
+            if (_completion != NULL)
+            {
+                _completion->set_pruned();
+            }
+        }
+
+        tbb::task* execute() override
+        {
+            _completion->set_ready();
+            _completion = NULL;
+            return NULL;
+        }
+    };
+
+    drain_task* _drain;
+    std::atomic<bool> _sealed;
+    cont_base _completion;
+
+    // if set, the tasks of the group are counted here instead of in the reference count of the drain task.
+    std::unique_ptr<completion_counter> _counter;
+
+    // if set, the tasks run in the group are added to this graph instead of running.
+    cont_graph* _capture = NULL;
+    size_t _capture_key = cont_graph::no_key;
+
+    // if set, the closures of the tasks run in the group (and the arrays of with_all) are put in this pool.
+    graph_pool* _pool = NULL;
+
+    size_t take_capture_key()
+    {
+        size_t key = _capture_key;
+        _capture_key = cont_graph::no_key;
+        return key;
+    }
+
+    void start_epoch()
+    {
+        _drain = new (owner().allocate_additional_child_of(owner())) drain_task(&_completion);
+        _drain->set_ref_count(1);
+        _sealed.store(false, std::memory_order_relaxed);
+
+        if (_counter)
+        {
+            _counter->reset_root(_drain);
+        }
+    }
+
+    void seal()
+    {
+        if (!_sealed.exchange(true, std::memory_order_acq_rel))
+        {
+            if (_drain->decrement_ref_count() == 0)
+            {
+                tbb::task::spawn(*_drain);
+            }
+        }
+    }
+
+    template<class TaskFun>
+    class task_runner : public counted_task
+    {
+        TaskFun mfun;
+
+    public:
+        template<class F>
+        explicit task_runner(F&& fun)
+            : mfun(std::forward<F>(fun))
+        { }
+
+        tbb::task* execute() override
+        {
+            mfun();
+            return NULL;
+        }
+    };
+
+    // the producer of a lazy cont (see run_lazy). it's allocated as a root task, which isn't counted anywhere,
+    // and only becomes a task of the group once the cont is needed, so that wait() waits for it if (and only if) it runs.
+    template<class TaskFun>
+    class lazy_task_runner : public counted_task
+    {
+        TaskFun mfun;
+        cont_task_group* _group;
+
+    public:
+        cont_node node;
+
+        template<class F>
+        lazy_task_runner(cont_task_group* group, F&& fun)
+            : mfun(std::forward<F>(fun))
+            , _group(group)
+        {
+            node.task = this;
+            node.next = NULL;
+            node.notify = &start;
+            node.context = this;
+        }
+
+        tbb::task* execute() override
+        {
+            mfun();
+            return NULL;
+        }
+
+        // it's started because its cont is needed, not because a cont of its own became ready, so there's no affinity to pass on.
+        static void start(cont_node* node, tbb::task::affinity_id)
+        {
+            lazy_task_runner* t = (lazy_task_runner*)node->context;
+            t->_group->adopt_task(*t);
+            tbb::task::spawn(*t);
+        }
+    };
+
+    template<class TaskFun, int NumConts>
+    class cont_task_runner : public counted_task
+    {
+        TaskFun mfun;
+
+    public:
+        std::array<cont_base*, NumConts> conts;
+        std::array<cont_node, NumConts> nodes;
+
+        template<class F>
+        explicit cont_task_runner(F&& fun)
+            : mfun(std::forward<F>(fun))
+        { }
+
+        tbb::task* execute() override
+        {
+            mfun();
+            return NULL;
+        }
+    };
+
+    // like cont_task_runner, but for a number of conts that is only known at runtime.
+    template<class TaskFun>
+    class dynamic_cont_task_runner : public counted_task
+    {
+        TaskFun mfun;
+
+    public:
+        std::vector<cont_base*, slab_std_allocator<cont_base*>> conts;
+        std::vector<cont_node, slab_std_allocator<cont_node>> nodes;
+        std::vector<cont_fan_in, tbb::cache_aligned_allocator<cont_fan_in>> fan_ins;
+
+        template<class F>
+        dynamic_cont_task_runner(F&& fun, cont_base* const* cont_array, int num_conts)
+            : mfun(std::forward<F>(fun))
+            , conts(cont_array, cont_array + num_conts)
+            , nodes(num_conts)
+            , fan_ins(fan_in_tree_size(num_conts))
+        { }
+
+        tbb::task* execute() override
+        {
+            mfun();
+            return NULL;
+        }
+    };
+
+    // like cont_task_runner, but if any of its conts gets pruned instead of set ready, it's skipped without running,
+    // and its outputs are pruned in turn (see cont_base::set_pruned.)
+    template<class TaskFun, int NumConts, int NumOuts>
+    class prunable_task_runner : public counted_task
+    {
+        TaskFun mfun;
+
+    public:
+        std::array<cont_base*, NumConts> conts;
+        std::array<cont_node, NumConts> nodes;
+        std::array<cont_base*, NumOuts> outputs;
+
+        template<class F>
+        explicit prunable_task_runner(F&& fun)
+            : mfun(std::forward<F>(fun))
+        { }
+
+        tbb::task* execute() override
+        {
+            mfun();
+            return NULL;
+        }
+
+        // called once all the conts are resolved. by then they're all ready or pruned for good, so their state can be read without races.
+        void release(tbb::task_arena* arena, tbb::task::affinity_id affinity)
+        {
+            for (cont_base* c : conts)
+            {
+                if (c->is_pruned())
+                {
+                    for (cont_base* out : outputs)
+                    {
+                        out->set_pruned();
+                    }
+                    skip_task(*this);
+                    return;
+                }
+            }
+
+            if (affinity != 0)
+            {
+                set_affinity(affinity);
+            }
+            spawn_in_arena(*this, arena);
+        }
+
+        static void notify(cont_node* node, tbb::task::affinity_id affinity)
+        {
+            prunable_task_runner* t = (prunable_task_runner*)node->context;
+            if (t->decrement_ref_count() == 0)
+            {
+                t->release(node->arena, affinity);
+            }
+        }
+
+        // like spawn_when_ready, but every cont is registered with the notify hook, so that the task is released through release().
+        void spawn_when_resolved()
+        {
+            add_ref_count(NumConts);
+
+            int num_inputs_already_ok = 0;
+            for (int i = 0; i < NumConts; i++)
+            {
+                nodes[i].notify = &notify;
+                nodes[i].context = this;
+
+                if (!conts[i]->try_register_successor(this, &nodes[i]))
+                {
+                    num_inputs_already_ok++;
+                }
+            }
+
+            // a task without any conts has nothing to wait for (and nothing that can be pruned), so it's released right away.
+            if ((num_inputs_already_ok > 0 || NumConts == 0) && add_ref_count(-num_inputs_already_ok) == 0)
+            {
+                release(NULL, 0);
+            }
+        }
+    };
+
+    // holds a closure that's in the pool of the group, and destroys it along with the task.
+    template<class TaskFun>
+    class pooled_fun
+    {
+        TaskFun* _fun;
+
+    public:
+        explicit pooled_fun(TaskFun* fun)
+            : _fun(fun)
+        { }
+
+        pooled_fun(pooled_fun&& other)
+            : _fun(other._fun)
+        {
+            other._fun = NULL;
+        }
+
+        ~pooled_fun()
+        {
+            if (_fun != NULL)
+            {
+                _fun->~TaskFun();
+            }
+        }
+
+        void operator()()
+        {
+            (*_fun)();
+        }
+    };
+
+    // like dynamic_cont_task_runner, but with its arrays (and its closure) in the pool of the group.
+    template<class TaskFun>
+    class pooled_cont_task_runner : public counted_task
+    {
+        pooled_fun<TaskFun> mfun;
+
+    public:
+        cont_base** conts;
+        cont_node* nodes;
+        cont_fan_in* fan_ins;
+
+        pooled_cont_task_runner(graph_pool& pool, TaskFun* fun, cont_base* const* cont_array, int num_conts)
+            : mfun(fun)
+            , conts(pool.make_array<cont_base*>(num_conts))
+            , nodes(pool.make_array<cont_node>(num_conts))
+            , fan_ins(pool.make_array<cont_fan_in>(fan_in_tree_size(num_conts)))
+        {
+            std::copy(cont_array, cont_array + num_conts, conts);
+        }
+
+        tbb::task* execute() override
+        {
+            mfun();
+            return NULL;
+        }
+    };
+
+    // true if the closure of a task of type Task goes in the pool, instead of in the task itself.
+    template<class Task>
+    bool pools_closure_of() const
+    {
+        return _pool != NULL && sizeof(Task) > quick_task_size;
+    }
+
+    template<typename F>
+    pooled_fun<std::decay_t<F>> pool_fun(F&& f)
+    {
+        return pooled_fun<std::decay_t<F>>(_pool->construct<std::decay_t<F>>(std::forward<F>(f)));
+    }
+
+    // a task of the group that waits for the completion of the group would be waiting for itself.
+    bool is_own_completion(cont_base* const* conts, int num_conts) const
+    {
+        return std::find(conts, conts + num_conts, &_completion) != conts + num_conts;
+    }
+
+    // allocates a task of this group, either as a child of the drain task or as a root task of its own that's counted by _counter.
+    template<class Task, class... Args>
+    Task& allocate_task(Args&&... args)
+    {
+        // once the group is sealed, only its own tasks (which run in its context) may add tasks to it. from anywhere else,
+        // the drain task might already have run, and be gone. this includes the tasks of other groups nested in the tasks of this one.
+        assert(!_sealed.load(std::memory_order_relaxed) || tbb::task::self().group() == &my_context);
+
+        if (!_counter)
+        {
+            return *new (_drain->allocate_additional_child_of(*_drain)) Task(std::forward<Args>(args)...);
+        }
+
+        Task& t = *new (tbb::task::allocate_root(my_context)) Task(std::forward<Args>(args)...);
+        t.count_in(*_counter);
+        return t;
+    }
+
+    // makes a root task of the group's context a task of the group, like allocate_task would have.
+    void adopt_task(counted_task& t)
+    {
+        // the same restriction as for allocate_task: the task that needs the cont has to be a task of this group (or the group not sealed.)
+        assert(!_sealed.load(std::memory_order_relaxed) || tbb::task::self().group() == &my_context);
+
+        if (!_counter)
+        {
+            _drain->increment_ref_count();
+            t.set_parent(_drain);
+            return;
+        }
+
+        t.count_in(*_counter);
+    }
+
+public:
+    cont_task_group()
+    {
+        start_epoch();
+    }
+
+    // with completion_tracking::distributed, the tasks of the group are counted with a completion_counter instead of the
+    // reference count of a single task, which scales better for groups of huge numbers of small tasks spawned from many threads.
+    explicit cont_task_group(completion_tracking tracking)
+    {
+        start_epoch();
+
+        if (tracking == completion_tracking::distributed)
+        {
+            _counter.reset(new completion_counter(_drain));
+        }
+    }
+
+    ~cont_task_group()
+    {
+        if (!_sealed.load(std::memory_order_relaxed) && _drain->ref_count() == 1)
+        {
+            // nothing ran since the last wait(), so the drain task can go away without running.
+            tbb::task::destroy(*_drain);
+        }
+        else
+        {
+            // this is a missing wait(), which tbb::task_group's destructor reports once the drain task had a chance to finish.
+            seal();
+        }
+    }
+
+    // the closure is moved or copied straight into the task, so move-only closures work too.
+    template<typename F>
+    void run(F&& f)
+    {
+        if (_capture != NULL)
+        {
+            _capture->add(std::forward<F>(f), NULL, 0, take_capture_key());
+            return;
+        }
+
+        if (pools_closure_of<task_runner<std::decay_t<F>>>())
+        {
+            tbb::task::spawn(allocate_task<task_runner<pooled_fun<std::decay_t<F>>>>(pool_fun(std::forward<F>(f))));
+            return;
+        }
+
+        tbb::task::spawn(allocate_task<task_runner<std::decay_t<F>>>(std::forward<F>(f)));
+    }
+
+    // runs f(i) for every i in [begin, end). the range is a single task of the group that splits itself over the workers,
+    // so it costs one reference and one spawn from the calling thread instead of one of each for every index.
+    template<typename F>
+    void run_range(int begin, int end, F&& f)
+    {
+        // the tasks of a range are made up as it runs, so there's nothing to capture.
+        assert(_capture == NULL);
+
+        if (begin >= end)
+        {
+            return;
+        }
+
+        auto& t = allocate_task<range_root_task<std::decay_t<F>>>(std::forward<F>(f));
+        t.range = tbb::blocked_range<int>(begin, end, default_range_grainsize(begin, end));
+        tbb::task::spawn(t);
+    }
+
+    // like run_range, but the result of f(i) is put in outs[i - begin], which is set ready right after.
+    template<typename F, typename R>
+    void run_range(int begin, int end, F&& f, cont<R>* outs)
+    {
+        run_range(begin, end, [fun = std::forward<F>(f), begin, outs](int i) {
+            cont<R>& out = outs[i - begin];
+            out.emplace(fun(i));
+            out.set_ready();
+        });
+    }
+
+    // makes f the producer of the cont, which only runs once the cont is needed: when the first successor registers on it
+    // (like with with() or with_all()), or on demand(). if it never is, f never runs, and unused branches of the graph cost nothing.
+    // the producer becomes a task of the group when it's set off, so wait() waits for it from then on, like for any other task.
+    // so the cont has to be needed from a task of the group, or before the group is waited for, and while the group is still around
+    // (if the cont goes away first, the producer is just destroyed.)
+    template<typename F>
+    void run_lazy(cont_base& c, F&& f)
+    {
+        assert(_capture == NULL);
+        auto* t = new (tbb::task::allocate_root(my_context)) lazy_task_runner<std::decay_t<F>>(this, std::forward<F>(f));
+        c.set_lazy_producer(&t->node);
+    }
+
+    // runs f in the given arena, like the arena of a NUMA node (see numa_arenas), while it still counts as a task of this group.
+    template<typename F>
+    void run_in(tbb::task_arena& arena, F&& f)
+    {
+        assert(_capture == NULL);
+        spawn_in_arena(allocate_task<task_runner<std::decay_t<F>>>(std::forward<F>(f)), &arena);
+    }
+
+    // from now on, the closures of the tasks run in the group (and the arrays of with_all) are put in the pool,
+    // instead of in the tasks themselves or on the heap. only the closures are pooled: the tasks still come from TBB's allocator,
+    // which recycles them on its own, and a task only points to its closure, which is one more indirection to run it.
+    // so a closure that's small enough for its task to stay under quick_task_size stays in the task, where it's already cheap.
+    // the pool must only be cleared once the group has been waited for. NULL goes back to not using a pool.
+    void use_pool(graph_pool* pool)
+    {
+        _pool = pool;
+    }
+
+    // like tbb::task_group::run_and_wait: f runs on the calling thread, unless the group is already cancelled,
+    // and if it throws, the group is cancelled and the exception comes out of wait().
+    // this can't just call internal_run_and_wait(), since that waits with tbb::task_group::wait(), which doesn't seal the group.
+    template<typename F>
+    tbb::task_group_status run_and_wait(const F& f)
+    {
+        try
+        {
+            if (!my_context.is_group_execution_cancelled())
+            {
+                f();
+            }
+        }
+        catch (...)
+        {
+            my_context.register_pending_exception();
+        }
+        return wait();
+    }
+
+    // returns a cont that becomes ready once all the tasks run in the group so far (and all the tasks they run in the group) have finished.
+    // unlike wait(), this doesn't block, so the tasks of another group can depend on the whole group with other.with(g.completion()).
+    // a task of this group can't: it would be waiting for itself. if the group gets cancelled, the cont is pruned instead.
+    // this seals the group: after that only tasks of the group itself can run more tasks in it, until wait() reopens it.
+    cont_base& completion()
+    {
+        seal();
+        return _completion;
+    }
+
+    tbb::task_group_status wait()
+    {
+        seal();
+
+        tbb::task_group_status status;
+        try
+        {
+            status = tbb::task_group::wait();
+        }
+        catch (...)
+        {
+            _completion.reset();
+            start_epoch();
+            throw;
+        }
+
+        _completion.reset();
+        start_epoch();
+        return status;
+    }
+
+    // from now on, the tasks run in the group (from this thread, with run(), with() or with_all()) are added to the graph instead of running,
+    // until end_capture(). the graph can then be replayed as many times as needed with cont_graph::replay().
+    // only the tasks run while capturing are part of the graph, not the tasks that they run in turn when they're replayed.
+    // if the graph was captured before, it gets patched to match the new capture (see cont_graph.)
+    void begin_capture(cont_graph& graph)
+    {
+        assert(_capture == NULL);
+        _capture = &graph;
+        _capture->begin_capture();
+    }
+
+    // gives a key to the next task captured, so that a later capture can match it even if tasks were added or removed before it.
+    // keys don't mix with the positions of the tasks captured without one, but can't use the highest bit (see cont_graph::explicit_key_bit.)
+    // returns the group, for chaining like g.capture_key(k).with(c).run(f).
+    cont_task_group& capture_key(size_t key)
+    {
+        _capture_key = key;
+        return *this;
+    }
+
+    // declares a cont that the tasks captured so far set ready, but that no captured task waits for (see cont_graph::add_output.)
+    void capture_output(cont_base& c)
+    {
+        assert(_capture != NULL);
+        _capture->add_output(&c);
+    }
+
+    void end_capture()
+    {
+        _capture->end_capture();
+        _capture = NULL;
+    }
+
+    template<int NumConts, int NumOuts, class Refs>
+    class prunable_spawner
+    {
+        cont_task_group* group;
+        std::array<cont_base*, NumConts> conts;
+        std::array<cont_base*, NumOuts> outputs;
+        Refs refs;
+
+        // the handles are moved in, since a default shared_cont would be a new cont.
+        explicit prunable_spawner(Refs&& r)
+            : refs(std::move(r))
+        { }
+
+    public:
+        friend class cont_task_group;
+
+        template<typename F>
+        void run(F&& f)
+        {
+            // pruning happens as the conts are resolved, which a replay of a captured graph doesn't know about.
+            assert(group->_capture == NULL);
+            assert(!group->is_own_completion(conts.data(), NumConts));
+
+            auto&& fun = hold_refs(std::forward<F>(f), std::move(refs));
+            auto& t = group->allocate_task<prunable_task_runner<std::decay_t<decltype(fun)>, NumConts, NumOuts>>(std::forward<decltype(fun)>(fun));
+            t.conts = conts;
+            t.outputs = outputs;
+            t.spawn_when_resolved();
+        }
+    };
+
+    // Refs are the handles the task holds on the shared conts among its arguments (see shared_refs.)
+    template<int NumConts, class Refs>
+    class with_spawner
+    {
+        cont_task_group* group;
+        std::array<cont_base*, NumConts> conts;
+        Refs refs;
+
+        explicit with_spawner(Refs&& r)
+            : refs(std::move(r))
+        { }
+
+    public:
+        friend class cont_task_group;
+
+        // declares the outputs of the task, so that if any of its conts gets pruned, the task is skipped and prunes them instead
+        // of running, like g.with(c).or_prune(out).run(f). the task must set every output ready (or pruned) when it does run.
+        template<class... Out>
+        auto or_prune(Out&... outs)
+        {
+            auto all_refs = std::tuple_cat(std::move(refs), shared_refs(outs)...);
+            prunable_spawner<NumConts, sizeof...(Out), decltype(all_refs)> spawner(std::move(all_refs));
+            spawner.group = group;
+            spawner.conts = conts;
+            spawner.outputs = { as_cont_base(outs)... };
+            return spawner;
+        }
+
+        template<typename F>
+        void run(F&& f)
+        {
+            assert(!group->is_own_completion(conts.data(), NumConts));
+
+            auto&& fun = hold_refs(std::forward<F>(f), std::move(refs));
+            typedef std::decay_t<decltype(fun)> Fun;
+
+            if (group->_capture != NULL)
+            {
+                group->_capture->add(std::forward<decltype(fun)>(fun), conts.data(), NumConts, group->take_capture_key());
+                return;
+            }
+
+            if (group->pools_closure_of<cont_task_runner<Fun, NumConts>>())
+            {
+                auto& t = group->allocate_task<cont_task_runner<pooled_fun<Fun>, NumConts>>(group->pool_fun(std::forward<decltype(fun)>(fun)));
+                t.conts = conts;
+                spawn_when_ready(t, t.conts.data(), t.nodes.data(), (int)t.conts.size());
+                return;
+            }
+
+            auto& t = group->allocate_task<cont_task_runner<Fun, NumConts>>(std::forward<decltype(fun)>(fun));
+            t.conts = conts;
+            spawn_when_ready(t, t.conts.data(), t.nodes.data(), (int)t.conts.size());
+        }
+    };
+
+    template<class... Cont>
+    auto with(Cont&... conts)
+    {
+        auto refs = std::tuple_cat(shared_refs(conts)...);
+        with_spawner<sizeof...(conts), decltype(refs)> spawner(std::move(refs));
+        spawner.group = this;
+        spawner.conts = { as_cont_base(conts)... };
+        return spawner;
+    }
+
+    class dynamic_with_spawner
+    {
+        cont_task_group* group;
+        cont_base* const* conts;
+        int num_conts;
+
+        dynamic_with_spawner() = default;
+
+    public:
+        friend class cont_task_group;
+
+        template<typename F>
+        void run(F&& f)
+        {
+            assert(!group->is_own_completion(conts, num_conts));
+
+            if (group->_capture != NULL)
+            {
+                group->_capture->add(std::forward<F>(f), conts, num_conts, group->take_capture_key());
+                return;
+            }
+
+            if (group->_pool != NULL)
+            {
+                graph_pool& pool = *group->_pool;
+                auto* fun = pool.construct<std::decay_t<F>>(std::forward<F>(f));
+                auto& t = group->allocate_task<pooled_cont_task_runner<std::decay_t<F>>>(pool, fun, conts, num_conts);
+                spawn_when_ready(t, t.conts, t.nodes, t.fan_ins, num_conts);
+                return;
+            }
+
+            auto& t = group->allocate_task<dynamic_cont_task_runner<std::decay_t<F>>>(std::forward<F>(f), conts, num_conts);
+            spawn_when_ready(t, t.conts.data(), t.nodes.data(), t.fan_ins.data(), num_conts);
+        }
+    };
+
+    // like with(), but for an array of conts. the array is copied into the task, so it only has to live until run() returns.
+    // large numbers of conts are combined through a fan-in tree (see spawn_when_ready.)
+    dynamic_with_spawner with_all(cont_base* const* conts, int num_conts)
+    {
+        dynamic_with_spawner spawner;
+        spawner.group = this;
+        spawner.conts = conts;
+        spawner.num_conts = num_conts;
+        return spawner;
+    }
+};
@@ -0,0 +1,200 @@
+// how a group of tasks keeps track of the tasks that haven't finished yet, and the tasks that are counted that way.
+
+#pragma once
+
+#include "cont.h"
+
+#include <tbb/task.h>
+#include <tbb/cache_aligned_allocator.h>
+#include <tbb/task_arena.h>
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+// how a group of tasks keeps track of the tasks that haven't finished yet.
+enum class completion_tracking
+{
+    // every task is a child of the group's root task, so they all count in the root's reference count.
+    root_ref_count,
+
+    // tasks are counted by a completion_counter, which spreads the count over one cache line per worker thread.
+    distributed
+};
+
+// scalable count of the pending tasks of a group, as an alternative to counting every one of them in the root task's reference count.
+// it's a two-level "scalable non-zero indicator" (SNZI): each worker thread counts the tasks it spawned on its own leaf,
+// and the root task's reference count only holds one reference for each leaf that is currently non-zero.
+// so the root is only touched when a leaf goes from zero to non-zero or back, not once for every task.
+class completion_counter
+{
+public:
+    // the low half of the state is twice the number of pending tasks counted on this leaf, where the odd value 1 means
+    // "a first task is being counted in, but the root doesn't know about it yet". the high half is a version number,
+    // which is bumped every time the leaf leaves zero, so that a stale view of that transition can't be mistaken for a current one.
+    struct alignas(64) leaf
+    {
+        std::atomic<uint64_t> state;
+    };
+
+private:
+    tbb::task* _root;
+    std::vector<leaf, tbb::cache_aligned_allocator<leaf>> _leaves;
+
+    static const uint64_t count_mask = 0xFFFFFFFF;
+
+    void root_arrive()
+    {
+        _root->increment_ref_count();
+    }
+
+    void root_depart()
+    {
+        if (_root->decrement_ref_count() == 0)
+        {
+            // same as what the scheduler does when the last child of a task completes.
+            tbb::task::spawn(*_root);
+        }
+    }
+
+public:
+    explicit completion_counter(tbb::task* root)
+        : _root(root)
+        , _leaves(std::max(tbb::this_task_arena::max_concurrency(), 1))
+    {
+        for (leaf& l : _leaves)
+        {
+            l.state.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    completion_counter(const completion_counter&) = delete;
+    completion_counter& operator=(const completion_counter&) = delete;
+
+    // changes the task whose reference count holds the references of the leaves. only valid while no tasks are counted.
+    void reset_root(tbb::task* root)
+    {
+        _root = root;
+    }
+
+    // counts one more pending task on the calling thread's leaf.
+    // returns the leaf, which the task has to depart() from when it's done (possibly from another thread.)
+    leaf* arrive()
+    {
+        // threads that aren't part of the arena get a negative index, they share the first leaf.
+        int thread_index = std::max(tbb::this_task_arena::current_thread_index(), 0);
+        leaf* l = &_leaves[thread_index % _leaves.size()];
+
+        int num_undone_root_arrivals = 0;
+
+        for (;;)
+        {
+            uint64_t state = l->state.load(std::memory_order_acquire);
+            uint64_t expected = state;
+            bool arrived = false;
+
+            if ((state & count_mask) >= 2)
+            {
+                // the root already knows this leaf is non-zero, so just count the task on the leaf.
+                arrived = l->state.compare_exchange_weak(expected, state + 2, std::memory_order_acq_rel, std::memory_order_relaxed);
+            }
+            else if ((state & count_mask) == 0)
+            {
+                uint64_t half = (((state >> 32) + 1) << 32) | 1;
+                if (l->state.compare_exchange_weak(expected, half, std::memory_order_acq_rel, std::memory_order_relaxed))
+                {
+                    arrived = true;
+                    state = half;
+                }
+            }
+
+            if ((state & count_mask) == 1)
+            {
+                // someone (maybe us) is counting in the first task of the leaf. everyone who sees that helps by arriving at the root,
+                // since the first task can't be considered counted until the root knows. only one of them gets to turn
+                // the half into a whole task, the others take their root arrival back once they're done.
+                root_arrive();
+
+                expected = state;
+                if (!l->state.compare_exchange_strong(expected, (state & ~count_mask) | 2, std::memory_order_acq_rel, std::memory_order_relaxed))
+                {
+                    num_undone_root_arrivals++;
+                }
+            }
+
+            if (arrived)
+            {
+                break;
+            }
+        }
+
+        for (; num_undone_root_arrivals > 0; num_undone_root_arrivals--)
+        {
+            root_depart();
+        }
+
+        return l;
+    }
+
+    // counts out a task that arrive()d on the given leaf.
+    void depart(leaf* l)
+    {
+        uint64_t old_state = l->state.fetch_sub(2, std::memory_order_acq_rel);
+        if ((old_state & count_mask) == 2)
+        {
+            // that was the last pending task of this leaf.
+            root_depart();
+        }
+    }
+};
+
+// base class for tasks that are counted by a completion_counter instead of by their parent's reference count.
+// the task counts itself out when it's destroyed, which also happens for tasks that get cancelled instead of executed.
+class counted_task : public tbb::task
+{
+    completion_counter* _counter = NULL;
+    completion_counter::leaf* _leaf = NULL;
+
+public:
+    void count_in(completion_counter& counter)
+    {
+        _counter = &counter;
+        _leaf = counter.arrive();
+    }
+
+    bool is_counted() const
+    {
+        return _counter != NULL;
+    }
+
+    // makes the successor count in place of this task, for when this task finishes before the work it was counted for.
+    void hand_over_count(counted_task& successor)
+    {
+        successor._counter = _counter;
+        successor._leaf = _leaf;
+        _counter = NULL;
+        _leaf = NULL;
+    }
+
+    ~counted_task()
+    {
+        if (_counter != NULL)
+        {
+            _counter->depart(_leaf);
+        }
+    }
+};
+
+// gets rid of a task that was allocated to run but won't, as if it had run: its parent loses a reference,
+// and gets spawned if that was the last one (which tbb::task::destroy alone doesn't do.)
+inline void skip_task(tbb::task& t)
+{
+    tbb::task* parent = t.parent();
+    t.set_parent(NULL);
+    tbb::task::destroy(t);
+
+    if (parent != NULL && parent->decrement_ref_count() == 0)
+    {
+        tbb::task::spawn(*parent);
+    }
+}
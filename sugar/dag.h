@@ -0,0 +1,224 @@
+// DAGs whose shape is known when compiling, described with node<> and deps<> types.
+
+#pragma once
+
+#include "cont.h"
+
+#include <tbb/task.h>
+
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <new>
+#include <atomic>
+#include <exception>
+
+// compile-time DAGs, for graphs whose shape is known when compiling. the nodes are described with types, like
+//     dag<node<A>, node<B>, node<C, deps<A, B>>> d;
+//     d.run();
+// where A, B and C are the functor types of the nodes (which also identify them, so a type can only be used by one node),
+// and every node can only depend on nodes listed before it. the reference counts of the nodes and their successors are worked out
+// by the compiler, so running the DAG doesn't register anything: every node that finishes directly decrements the counts of its successors.
+template<class... Funs>
+struct deps
+{
+    static const int size = sizeof...(Funs);
+};
+
+template<class Fun, class Deps = deps<>>
+struct node
+{
+    typedef Fun fun_type;
+    typedef Deps deps_type;
+};
+
+// index of T in Funs, or the size of Funs if it isn't there.
+template<class T, class... Funs>
+struct dag_index_of
+{
+    static const int value = 0;
+};
+
+template<class T, class U, class... Funs>
+struct dag_index_of<T, U, Funs...>
+{
+    static const int value = std::is_same<T, U>::value ? 0 : 1 + dag_index_of<T, Funs...>::value;
+};
+
+// number of times T is in the given deps.
+template<class T, class Deps>
+struct dag_dep_count
+{
+    static const int value = 0;
+};
+
+template<class T, class U, class... Funs>
+struct dag_dep_count<T, deps<U, Funs...>>
+{
+    static const int value = (std::is_same<T, U>::value ? 1 : 0) + dag_dep_count<T, deps<Funs...>>::value;
+};
+
+// true if no type is in Funs more than once.
+template<class... Funs>
+struct dag_all_distinct
+{
+    static const bool value = true;
+};
+
+template<class U, class... Funs>
+struct dag_all_distinct<U, Funs...>
+{
+    static const bool value = dag_index_of<U, Funs...>::value == sizeof...(Funs) && dag_all_distinct<Funs...>::value;
+};
+
+// highest index in AllFuns of the given deps, or -1 if there are none.
+template<class Deps, class... AllFuns>
+struct dag_last_dep
+{
+    static const int value = -1;
+};
+
+template<class U, class... Funs, class... AllFuns>
+struct dag_last_dep<deps<U, Funs...>, AllFuns...>
+{
+    static const int first = dag_index_of<U, AllFuns...>::value;
+    static const int rest = dag_last_dep<deps<Funs...>, AllFuns...>::value;
+    static const int value = first > rest ? first : rest;
+};
+
+template<class... Nodes>
+class dag
+{
+    static const int num_nodes = sizeof...(Nodes);
+    static_assert(num_nodes > 0, "a dag needs at least one node");
+
+    // a dependency on a type used by two nodes would only find the first one, and release it twice.
+    static_assert(dag_all_distinct<typename Nodes::fun_type...>::value, "the nodes of a dag have to have distinct functor types");
+
+    template<int I>
+    using node_at = typename std::tuple_element<I, std::tuple<Nodes...>>::type;
+
+    std::tuple<typename Nodes::fun_type...> _funs;
+
+    // the tasks of one run of the DAG, which only live until the run is over.
+    struct frame
+    {
+        dag* graph;
+        tbb::task* tasks[num_nodes];
+
+        // set by the first node that throws. the nodes that haven't started yet are skipped from then on, but they still release
+        // their successors, otherwise the run would never be over. run() rethrows the exception once it is.
+        std::atomic<bool> failed;
+        std::exception_ptr exception;
+    };
+
+    template<int I>
+    class node_task : public tbb::task
+    {
+        static_assert(dag_last_dep<typename node_at<I>::deps_type, typename Nodes::fun_type...>::value < I,
+            "the dependencies of a node have to be nodes listed before it in the dag");
+
+        frame* _frame;
+
+        template<int J>
+        void release()
+        {
+            const int num_edges = dag_dep_count<typename node_at<I>::fun_type, typename node_at<J>::deps_type>::value;
+            if (num_edges > 0 && _frame->tasks[J]->add_ref_count(-num_edges) == 0)
+            {
+                tbb::task::spawn(*_frame->tasks[J]);
+            }
+        }
+
+        template<int... J>
+        void release_successors(std::integer_sequence<int, J...>)
+        {
+            int unused[] = { (release<J>(), 0)... };
+            (void)unused;
+        }
+
+    public:
+        explicit node_task(frame* f)
+            : _frame(f)
+        { }
+
+        tbb::task* execute() override
+        {
+            if (!_frame->failed.load(std::memory_order_acquire))
+            {
+                try
+                {
+                    std::get<I>(_frame->graph->_funs)();
+                }
+                catch (...)
+                {
+                    if (!_frame->failed.exchange(true, std::memory_order_acq_rel))
+                    {
+                        _frame->exception = std::current_exception();
+                    }
+                }
+            }
+            release_successors(std::make_integer_sequence<int, num_nodes>());
+            return NULL;
+        }
+    };
+
+    template<int... I>
+    void allocate_tasks(frame& f, tbb::task& root, tbb::task_list& sources, std::integer_sequence<int, I...>)
+    {
+        int unused[] = { (f.tasks[I] = new (root.allocate_child()) node_task<I>(&f), 0)... };
+        (void)unused;
+
+        for (int i = 0; i < num_nodes; i++)
+        {
+            f.tasks[i]->set_ref_count(initial_ref_counts[i]);
+            if (initial_ref_counts[i] == 0)
+            {
+                sources.push_back(*f.tasks[i]);
+            }
+        }
+    }
+
+public:
+    // number of dependencies of each node, which is what their reference counts start from.
+    static constexpr int initial_ref_counts[num_nodes] = { Nodes::deps_type::size... };
+
+    dag() = default;
+
+    explicit dag(typename Nodes::fun_type... funs)
+        : _funs(std::move(funs)...)
+    { }
+
+    // the functor of the node of type Fun.
+    template<class Fun>
+    Fun& get()
+    {
+        return std::get<dag_index_of<Fun, typename Nodes::fun_type...>::value>(_funs);
+    }
+
+    // runs every node once, in dependency order, and waits for all of them to finish.
+    // if a node throws, the nodes that haven't started yet are skipped, and the exception is rethrown here.
+    void run()
+    {
+        frame f;
+        f.graph = this;
+        f.failed = false;
+
+        tbb::task& root = *new (tbb::task::allocate_root()) tbb::empty_task();
+        root.set_ref_count(num_nodes + 1);
+
+        tbb::task_list sources;
+        allocate_tasks(f, root, sources, std::make_integer_sequence<int, num_nodes>());
+
+        root.spawn_and_wait_for_all(sources);
+        tbb::task::destroy(root);
+
+        if (f.exception)
+        {
+            std::rethrow_exception(f.exception);
+        }
+    }
+};
+
+template<class... Nodes>
+constexpr int dag<Nodes...>::initial_ref_counts[];
@@ -0,0 +1,231 @@
+// a pool for the closures, conts and bookkeeping of a graph, freed all at once.
+
+#pragma once
+
+#include "cont.h"
+
+#include <atomic>
+#include <utility>
+#include <type_traits>
+#include <new>
+#include <algorithm>
+#include <mutex>
+#include <cstdlib>
+
+// memory for the closures, conts and bookkeeping of a graph of tasks, which is freed all at once by clear() (or the destructor)
+// instead of object by object. the pool bumps a pointer through big blocks that it gets from malloc, so the objects of a graph end up
+// next to each other, and once it has grown to the size of the graph, running the graph again after clear() reuses the same blocks
+// without allocating from the system at all. a group uses it for the closures of the tasks it runs after cont_task_group::use_pool().
+// it can be allocated from by any thread, but nothing allocated from it may be in use any more when it's cleared.
+class graph_pool
+{
+    // the objects made with make() get destroyed by clear(), in the reverse order they were made.
+    struct destructor
+    {
+        void (*destroy)(void* object);
+        void* object;
+        destructor* next;
+    };
+
+    // a block of memory, followed by its capacity bytes. used can go past the capacity when several threads
+    // miss the end of the block at once, in which case they all move on to a new block.
+    struct alignas(std::max_align_t) block
+    {
+        block* next;
+        size_t capacity;
+        std::atomic<size_t> used;
+
+        char* data()
+        {
+            return (char*)(this + 1);
+        }
+    };
+
+    static const size_t block_capacity = 64 * 1024;
+
+    // the block that's allocated from, the blocks that were filled since the last clear(), and those that clear() freed up.
+    std::atomic<block*> _current;
+    block* _full = NULL;
+    block* _spare = NULL;
+    std::mutex _grow_mutex;
+
+    std::atomic<destructor*> _destructors;
+
+    // makes a block with room for at least size bytes the current one, unless another thread did that already.
+    void grow(block* seen, size_t size)
+    {
+        std::lock_guard<std::mutex> lock(_grow_mutex);
+        if (_current.load(std::memory_order_relaxed) != seen)
+        {
+            return;
+        }
+
+        block* b = NULL;
+        if (_spare != NULL && _spare->capacity >= size)
+        {
+            b = _spare;
+            _spare = b->next;
+        }
+        else
+        {
+            size_t capacity = size > block_capacity ? size : block_capacity;
+            void* memory = std::malloc(sizeof(block) + capacity);
+            if (memory == NULL)
+            {
+                throw std::bad_alloc();
+            }
+            b = new (memory) block;
+            b->capacity = capacity;
+        }
+        b->used.store(0, std::memory_order_relaxed);
+
+        if (seen != NULL)
+        {
+            seen->next = _full;
+            _full = seen;
+        }
+        _current.store(b, std::memory_order_release);
+    }
+
+    static void free_blocks(block* b)
+    {
+        while (b != NULL)
+        {
+            block* next = b->next;
+            b->~block();
+            std::free(b);
+            b = next;
+        }
+    }
+
+    void run_destructors()
+    {
+        destructor* d = _destructors.exchange(NULL, std::memory_order_acquire);
+        while (d != NULL)
+        {
+            d->destroy(d->object);
+            d = d->next;
+        }
+    }
+
+public:
+    graph_pool()
+        : _current(NULL)
+        , _destructors(NULL)
+    { }
+
+    graph_pool(const graph_pool&) = delete;
+    graph_pool& operator=(const graph_pool&) = delete;
+
+    ~graph_pool()
+    {
+        run_destructors();
+        free_blocks(_current.load(std::memory_order_relaxed));
+        free_blocks(_full);
+        free_blocks(_spare);
+    }
+
+    // throws std::bad_alloc if the pool needs a new block and malloc fails.
+    void* allocate(size_t size, size_t alignment)
+    {
+        // every allocation is rounded up to the alignment of malloc, so bigger alignments are made up for by allocating a bit more.
+        const size_t min_alignment = alignof(std::max_align_t);
+        size_t padded = (size + min_alignment - 1) & ~(min_alignment - 1);
+        if (alignment > min_alignment)
+        {
+            padded += alignment - min_alignment;
+        }
+
+        for (;;)
+        {
+            block* b = _current.load(std::memory_order_acquire);
+            if (b != NULL)
+            {
+                size_t offset = b->used.fetch_add(padded, std::memory_order_relaxed);
+                if (offset + padded <= b->capacity)
+                {
+                    intptr_t p = (intptr_t)(b->data() + offset);
+                    return (void*)((p + (intptr_t)alignment - 1) & ~((intptr_t)alignment - 1));
+                }
+            }
+
+            grow(b, padded);
+        }
+    }
+
+    // constructs an object in the pool that the caller destroys (but doesn't free.)
+    template<class T, class... Args>
+    T* construct(Args&&... args)
+    {
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // constructs an object in the pool that lives until the pool is cleared.
+    template<class T, class... Args>
+    T* make(Args&&... args)
+    {
+        T* object = construct<T>(std::forward<Args>(args)...);
+
+        if (!std::is_trivially_destructible<T>::value)
+        {
+            destructor* d = construct<destructor>();
+            d->destroy = [](void* object) { ((T*)object)->~T(); };
+            d->object = object;
+            d->next = _destructors.load(std::memory_order_relaxed);
+            while (!_destructors.compare_exchange_weak(d->next, d, std::memory_order_release, std::memory_order_relaxed))
+            { }
+        }
+
+        return object;
+    }
+
+    // for conts made while the graph is built (or while it runs), instead of new-ing them or keeping them on some stack.
+    template<class T>
+    cont<T>& make_cont()
+    {
+        return *make<cont<T>>();
+    }
+
+    // an array of n value-initialized objects that need no destructor, like the cont_nodes of a task.
+    template<class T>
+    T* make_array(size_t n)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "the elements of the array are never destroyed");
+
+        T* objects = (T*)allocate(sizeof(T) * n, alignof(T));
+        for (size_t i = 0; i < n; i++)
+        {
+            new (&objects[i]) T();
+        }
+        return objects;
+    }
+
+    // the blocks are kept for what's allocated after, the first one of them (the biggest, if some had to be made bigger) first.
+    void clear()
+    {
+        run_destructors();
+
+        block* current = _current.exchange(NULL, std::memory_order_relaxed);
+        if (current != NULL)
+        {
+            current->next = _full;
+            _full = current;
+        }
+
+        while (_full != NULL)
+        {
+            block* b = _full;
+            _full = b->next;
+            if (_spare != NULL && b->capacity < _spare->capacity)
+            {
+                b->next = _spare->next;
+                _spare->next = b;
+            }
+            else
+            {
+                b->next = _spare;
+                _spare = b;
+            }
+        }
+    }
+};
@@ -0,0 +1,325 @@
+// task arenas for the NUMA nodes of the machine, and the observers that keep track of the arena a thread works in.
+
+#pragma once
+
+#include "cont.h"
+
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_observer.h>
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <sstream>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+// parses a list of CPUs or nodes in the format of /sys, like "0-3,8-11".
+inline std::vector<int> parse_sys_list(const std::string& list)
+{
+    std::vector<int> values;
+    std::stringstream ss(list);
+    std::string range;
+
+    while (std::getline(ss, range, ','))
+    {
+        if (range.empty())
+        {
+            continue;
+        }
+
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+
+        for (int value = first; value <= last; value++)
+        {
+            values.push_back(value);
+        }
+    }
+
+    return values;
+}
+
+// keeps current_arena() up to date for the threads that work in an arena, so that conts registered from there
+// release their successors back into it rather than into whichever arena produced the cont.
+// arenas that aren't tracked count as NULL, and their successors are spawned wherever the cont becomes ready,
+// so the default arena needs a tracker of its own too (see default_arena_tracker.)
+class arena_tracker : public tbb::task_scheduler_observer
+{
+    tbb::task_arena* _arena;
+
+    // the arena the current thread was in before it entered each of the tracked arenas it's in, innermost last,
+    // since a thread that enters an arena with execute() comes back to the arena it was in before.
+    struct saved_arena
+    {
+        const arena_tracker* tracker;
+        tbb::task_arena* arena;
+    };
+
+    static std::vector<saved_arena>& saved_arenas()
+    {
+        static thread_local std::vector<saved_arena> arenas;
+        return arenas;
+    }
+
+public:
+    // derived observers pass observe_now = false and start observing once they're fully constructed.
+    explicit arena_tracker(tbb::task_arena& arena, bool observe_now = true)
+        : tbb::task_scheduler_observer(arena)
+        , _arena(&arena)
+    {
+        if (observe_now)
+        {
+            observe(true);
+        }
+    }
+
+    ~arena_tracker()
+    {
+        observe(false);
+    }
+
+    void on_scheduler_entry(bool) override
+    {
+        saved_arena previous;
+        previous.tracker = this;
+        previous.arena = current_arena();
+        saved_arenas().push_back(previous);
+
+        current_arena() = _arena;
+    }
+
+    void on_scheduler_exit(bool) override
+    {
+        std::vector<saved_arena>& arenas = saved_arenas();
+        if (!arenas.empty() && arenas.back().tracker == this)
+        {
+            current_arena() = arenas.back().arena;
+            arenas.pop_back();
+        }
+        else if (current_arena() == _arena)
+        {
+            current_arena() = NULL;
+        }
+    }
+};
+
+// tracks the implicit arena of the thread that makes it (normally the main thread), which has no task_arena of its own otherwise.
+// successors registered from there are then spawned back into it, instead of into the arena of whichever thread sets the cont ready.
+class default_arena_tracker
+{
+    tbb::task_arena _arena;
+    arena_tracker _tracker;
+
+public:
+    default_arena_tracker()
+        : _arena(tbb::task_arena::attach())
+        , _tracker(_arena)
+    {
+        // the thread that makes the tracker is in the arena already, so it won't be told it entered it.
+        current_arena() = &_arena;
+    }
+
+    default_arena_tracker(const default_arena_tracker&) = delete;
+    default_arena_tracker& operator=(const default_arena_tracker&) = delete;
+
+    ~default_arena_tracker()
+    {
+        if (current_arena() == &_arena)
+        {
+            current_arena() = NULL;
+        }
+    }
+
+    tbb::task_arena& arena()
+    {
+        return _arena;
+    }
+};
+
+// the NUMA nodes of the machine that have CPUs, and their CPUs.
+struct numa_topology
+{
+    std::vector<std::vector<int>> node_cpus;
+
+    // reads the topology from /sys on Linux. everywhere else (or if that fails), it's a single node with an empty list of CPUs,
+    // which means the threads of its arena aren't pinned.
+    static numa_topology detect()
+    {
+        numa_topology topology;
+
+#ifdef __linux__
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string nodes;
+        if (std::getline(online, nodes))
+        {
+            for (int node : parse_sys_list(nodes))
+            {
+                std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                std::string cpus;
+                if (std::getline(cpulist, cpus))
+                {
+                    std::vector<int> node_cpus = parse_sys_list(cpus);
+
+                    // nodes with memory but no CPUs can't have an arena.
+                    if (!node_cpus.empty())
+                    {
+                        topology.node_cpus.push_back(node_cpus);
+                    }
+                }
+            }
+        }
+#endif
+
+        if (topology.node_cpus.empty())
+        {
+            topology.node_cpus.emplace_back();
+        }
+
+        return topology;
+    }
+};
+
+// one task_arena for every NUMA node, with as many slots as the node has CPUs, and its worker threads pinned to these CPUs.
+// conts that get the arena of a node as home arena (see cont_base::set_home_arena) have their successors run there,
+// so that they read the cont's data from the memory of their own node. the data that the producers allocate while running
+// in the arena of a node (like the contents of a cont<std::vector<T>>) is first touched there, so it ends up in the memory of that node.
+// this only places tasks, not memory: the conts themselves live wherever their owner allocated them, and so does a value that is
+// stored inline in the cont (like a cont<std::array<T, N>>). putting those in the memory of a node is the caller's job, like allocating
+// the cont from a task run in the node's arena (see cont_task_group::run_in), since only the workers of the arena are pinned to the node.
+class numa_arenas
+{
+    // pins the workers of an arena to the CPUs of its node, on top of keeping current_arena() up to date.
+    // workers move from arena to arena, so they get their previous CPUs back when they leave, instead of staying pinned to the node
+    // while they work in the default arena or in the arena of another node.
+    class pinning_observer : public arena_tracker
+    {
+        std::vector<int> _cpus;
+
+#ifdef __linux__
+        // the CPUs the current thread had before it entered each of the pinned arenas it's in, innermost last.
+        struct saved_mask
+        {
+            const pinning_observer* observer;
+            cpu_set_t cpus;
+        };
+
+        static std::vector<saved_mask>& saved_masks()
+        {
+            static thread_local std::vector<saved_mask> masks;
+            return masks;
+        }
+#endif
+
+    public:
+        pinning_observer(tbb::task_arena& arena, const std::vector<int>& cpus)
+            : arena_tracker(arena, false)
+            , _cpus(cpus)
+        {
+            observe(true);
+        }
+
+        ~pinning_observer()
+        {
+            observe(false);
+        }
+
+        void on_scheduler_entry(bool is_worker) override
+        {
+            arena_tracker::on_scheduler_entry(is_worker);
+
+#ifdef __linux__
+            // only workers are pinned: a master thread that visits the arena with execute() shouldn't stay stuck on the node afterwards.
+            if (is_worker && !_cpus.empty())
+            {
+                saved_mask previous;
+                previous.observer = this;
+                if (sched_getaffinity(0, sizeof(previous.cpus), &previous.cpus) != 0)
+                {
+                    return;
+                }
+                saved_masks().push_back(previous);
+
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                for (int cpu : _cpus)
+                {
+                    CPU_SET(cpu, &set);
+                }
+                sched_setaffinity(0, sizeof(set), &set);
+            }
+#endif
+        }
+
+        void on_scheduler_exit(bool is_worker) override
+        {
+            arena_tracker::on_scheduler_exit(is_worker);
+
+#ifdef __linux__
+            std::vector<saved_mask>& masks = saved_masks();
+            if (is_worker && !masks.empty() && masks.back().observer == this)
+            {
+                sched_setaffinity(0, sizeof(masks.back().cpus), &masks.back().cpus);
+                masks.pop_back();
+            }
+#endif
+        }
+    };
+
+    numa_topology _topology;
+    std::vector<std::unique_ptr<tbb::task_arena>> _arenas;
+    std::vector<std::unique_ptr<pinning_observer>> _observers;
+
+    // the arena of the thread that made this, so that the successors registered from there come back to it.
+    default_arena_tracker _default_arena;
+
+public:
+    explicit numa_arenas(const numa_topology& topology = numa_topology::detect())
+        : _topology(topology)
+    {
+        for (const std::vector<int>& cpus : _topology.node_cpus)
+        {
+            // no slots are reserved for masters, since the arenas are mostly fed by enqueueing successors into them.
+            int concurrency = cpus.empty() ? tbb::task_arena::automatic : (int)cpus.size();
+            _arenas.emplace_back(new tbb::task_arena(concurrency, 0));
+            _arenas.back()->initialize();
+            _observers.emplace_back(new pinning_observer(*_arenas.back(), cpus));
+        }
+    }
+
+    numa_arenas(const numa_arenas&) = delete;
+    numa_arenas& operator=(const numa_arenas&) = delete;
+
+    int num_nodes() const
+    {
+        return (int)_arenas.size();
+    }
+
+    tbb::task_arena& arena(int node)
+    {
+        return *_arenas[node];
+    }
+
+    const std::vector<int>& cpus(int node) const
+    {
+        return _topology.node_cpus[node];
+    }
+
+    // the node whose arena the current thread works in, or -1 if it's in none of them.
+    int current_node() const
+    {
+        for (int node = 0; node < num_nodes(); node++)
+        {
+            if (_arenas[node].get() == current_arena())
+            {
+                return node;
+            }
+        }
+        return -1;
+    }
+};
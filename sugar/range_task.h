@@ -0,0 +1,99 @@
+// the tasks that run a body on every index of a range, as one task of a group (see cont_task_group::run_range.)
+
+#pragma once
+
+#include "counted_task.h"
+
+#include <tbb/task.h>
+#include <tbb/task_arena.h>
+#include <tbb/blocked_range.h>
+
+#include <utility>
+#include <type_traits>
+#include <new>
+#include <algorithm>
+
+// splits a range of indices in halves recursively, and runs the body on every index of the pieces that can't be split further.
+// like tbb::parallel_for's start_for, each split makes a continuation that joins the two halves, spawns the right half,
+// and recycles the task as the left half, so the pieces are spawned in a tree instead of one by one from one thread.
+template<class Body>
+class range_task : public tbb::task
+{
+    tbb::blocked_range<int> _range;
+    const Body* _body;
+
+public:
+    range_task(const tbb::blocked_range<int>& range, const Body* body)
+        : _range(range)
+        , _body(body)
+    { }
+
+    tbb::task* execute() override
+    {
+        if (!_range.is_divisible())
+        {
+            for (int i = _range.begin(); i != _range.end(); i++)
+            {
+                (*_body)(i);
+            }
+            return NULL;
+        }
+
+        tbb::empty_task& join = *new (allocate_continuation()) tbb::empty_task();
+        range_task& right = *new (join.allocate_child()) range_task(tbb::blocked_range<int>(_range, tbb::split()), _body);
+        recycle_as_child_of(join);
+        join.set_ref_count(2);
+        tbb::task::spawn(right);
+        return this;
+    }
+};
+
+// true if body(i) can be called on a const Body, which is how the pieces of a range call it.
+template<class Body, class = void>
+struct is_range_body : std::false_type
+{ };
+
+template<class Body>
+struct is_range_body<Body, decltype((void)std::declval<const Body&>()(0))> : std::true_type
+{ };
+
+// the task that stands for a whole range: it owns the body, and stays around as its own continuation until all the pieces have run,
+// so whatever it is counted in (the reference count of its parent or a completion_counter) only counts it once.
+template<class Body>
+class range_root_task : public counted_task
+{
+    static_assert(is_range_body<Body>::value,
+        "the body of a range is called from many threads at once, through a const reference, so it can't be a mutable lambda");
+
+    Body _body;
+    bool _split = false;
+
+public:
+    tbb::blocked_range<int> range;
+
+    template<class B>
+    explicit range_root_task(B&& body)
+        : _body(std::forward<B>(body))
+        , range(0, 0)
+    { }
+
+    tbb::task* execute() override
+    {
+        if (_split)
+        {
+            return NULL;
+        }
+        _split = true;
+
+        range_task<Body>& first = *new (allocate_child()) range_task<Body>(range, &_body);
+        recycle_as_safe_continuation();
+        set_ref_count(2);
+        return &first;
+    }
+};
+
+// the grain size of ranges that aren't given one: about four pieces per worker, like the first splits of tbb::auto_partitioner.
+inline int default_range_grainsize(int begin, int end)
+{
+    return std::max(1, (end - begin) / (4 * std::max(tbb::this_task_arena::max_concurrency(), 1)));
+}
@@ -0,0 +1,173 @@
+// tasks declared by the resources they read and write, which find their dependencies on their own.
+
+#pragma once
+
+#include "cont_task_group.h"
+
+#include <vector>
+#include <unordered_map>
+#include <deque>
+#include <initializer_list>
+#include <utility>
+#include <algorithm>
+#include <string>
+
+// tasks declared by the resources they read and write, instead of by the conts they wait for. the dependencies are worked out
+// as the tasks are added, in the order they're added in, like a render graph does it: a task waits for the last task that wrote
+// any of the resources it reads (read after write), and a task that writes a resource also waits for that last writer
+// (write after write) and for all the tasks that read the resource since (write after read). tasks that don't conflict don't wait
+// for each other, even if they were added one after the other.
+// adding a task is a few array lookups per resource, so the whole graph can be declared again for every frame.
+class resource_graph
+{
+    // what happened to a resource so far in the current frame.
+    struct resource_state
+    {
+        size_t frame = 0;
+        int last_writer = -1;
+        std::vector<int> readers;
+    };
+
+    cont_task_group _group;
+    std::vector<resource_state> _resources;
+    std::unordered_map<std::string, int> _names;
+
+    // the cont that every task of the frame sets ready once it's done. the conts of older frames are reused.
+    std::deque<cont_base> _done;
+    int _num_tasks = 0;
+
+    // frames start at 1, so that the states of new resources count as older than any frame.
+    size_t _frame = 1;
+
+    std::vector<cont_base*> _deps;
+
+    resource_state& state(int resource)
+    {
+        resource_state& r = _resources[resource];
+        if (r.frame != _frame)
+        {
+            r.frame = _frame;
+            r.last_writer = -1;
+            r.readers.clear();
+        }
+        return r;
+    }
+
+public:
+    typedef int resource;
+
+    resource_graph() = default;
+
+    resource_graph(const resource_graph&) = delete;
+    resource_graph& operator=(const resource_graph&) = delete;
+
+    // a new resource, which is only known by its handle.
+    resource add_resource()
+    {
+        _resources.emplace_back();
+        return (resource)_resources.size() - 1;
+    }
+
+    // the resource with the given name, which is added the first time it's asked for.
+    // the handle can be kept to avoid looking up the name for every task.
+    resource named(const std::string& name)
+    {
+        auto found = _names.find(name);
+        if (found != _names.end())
+        {
+            return found->second;
+        }
+
+        resource r = add_resource();
+        _names.emplace(name, r);
+        return r;
+    }
+
+    // adds a task that reads and writes the given resources. a resource that's both read and written only has to be in writes,
+    // but it can be in both, and a resource can be listed more than once.
+    template<typename F>
+    void run(std::initializer_list<resource> reads, std::initializer_list<resource> writes, F&& f)
+    {
+        int task = _num_tasks++;
+        if (task == (int)_done.size())
+        {
+            _done.emplace_back();
+        }
+        else
+        {
+            _done[task].reset();
+        }
+
+        _deps.clear();
+
+        for (resource r : reads)
+        {
+            if (std::find(writes.begin(), writes.end(), r) != writes.end())
+            {
+                continue;
+            }
+
+            // a resource that's listed again was already read by this task, and it's the last reader so far.
+            resource_state& rs = state(r);
+            if (!rs.readers.empty() && rs.readers.back() == task)
+            {
+                continue;
+            }
+
+            if (rs.last_writer >= 0)
+            {
+                _deps.push_back(&_done[rs.last_writer]);
+            }
+            rs.readers.push_back(task);
+        }
+
+        for (resource r : writes)
+        {
+            // a resource that's listed again is already written by this task, which mustn't wait for itself.
+            resource_state& rs = state(r);
+            if (rs.last_writer == task)
+            {
+                continue;
+            }
+
+            if (rs.last_writer >= 0)
+            {
+                _deps.push_back(&_done[rs.last_writer]);
+            }
+            for (int reader : rs.readers)
+            {
+                _deps.push_back(&_done[reader]);
+            }
+            rs.readers.clear();
+            rs.last_writer = task;
+        }
+
+        // the same task can come up through several resources.
+        std::sort(_deps.begin(), _deps.end());
+        _deps.erase(std::unique(_deps.begin(), _deps.end()), _deps.end());
+
+        cont_base* done = &_done[task];
+        auto body = [fun = std::forward<F>(f), done]() mutable {
+            fun();
+            done->set_ready();
+        };
+
+        if (_deps.empty())
+        {
+            _group.run(std::move(body));
+        }
+        else
+        {
+            _group.with_all(_deps.data(), (int)_deps.size()).run(std::move(body));
+        }
+    }
+
+    // waits for all the tasks of the frame, and starts a new frame, in which the resources start over without any dependencies.
+    tbb::task_group_status wait()
+    {
+        tbb::task_group_status status = _group.wait();
+        _num_tasks = 0;
+        _frame++;
+        return status;
+    }
+};
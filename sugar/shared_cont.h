@@ -0,0 +1,162 @@
+// conts on the heap, shared through intrusively reference-counted handles.
+
+#pragma once
+
+#include "slab_allocator.h"
+
+#include <atomic>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+
+// a cont on the heap, shared by the tasks that produce and consume it through handles that count the references to it.
+// unlike a cont<T> on the stack, it doesn't need a task that waits for all of its consumers to keep it alive.
+// the count is in the cont itself, so copying a handle costs a single atomic increment and there's no separate control block.
+// the cont is destroyed along with the last handle. the handle that set_ready() is called through keeps the cont alive
+// while its successors are released, and a task registered with g.with(c) holds a handle until it's done, so its closure
+// can use *c without capturing one.
+template<class T>
+class shared_cont
+{
+    struct block : cont<T>
+    {
+        std::atomic<int> refs;
+
+        block()
+            : refs(1)
+        { }
+    };
+
+    block* _block;
+
+    void release()
+    {
+        if (_block != NULL && _block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            cont_slabs().destroy(_block);
+        }
+    }
+
+public:
+    // makes a new cont that isn't ready yet.
+    shared_cont()
+        : _block(cont_slabs().make<block>())
+    { }
+
+    shared_cont(const shared_cont& other)
+        : _block(other._block)
+    {
+        if (_block != NULL)
+        {
+            _block->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    shared_cont(shared_cont&& other)
+        : _block(other._block)
+    {
+        other._block = NULL;
+    }
+
+    shared_cont& operator=(shared_cont other)
+    {
+        std::swap(_block, other._block);
+        return *this;
+    }
+
+    ~shared_cont()
+    {
+        release();
+    }
+
+    cont<T>& get() const
+    {
+        return *_block;
+    }
+
+    T& operator*() const
+    {
+        return **_block;
+    }
+
+    T* operator->() const
+    {
+        return &**_block;
+    }
+
+    template<class... Args>
+    void emplace(Args&&... args) const
+    {
+        _block->emplace(std::forward<Args>(args)...);
+    }
+
+    bool is_ready() const
+    {
+        return _block->is_ready();
+    }
+
+    void set_ready(notify_order order = notify_order::last_registered_first) const
+    {
+        _block->set_ready(order);
+    }
+
+    bool is_pruned() const
+    {
+        return _block->is_pruned();
+    }
+
+    void set_pruned(notify_order order = notify_order::last_registered_first) const
+    {
+        _block->set_pruned(order);
+    }
+};
+
+// the cont that an argument of cont_task_group::with() stands for, so that shared conts can be passed to it like plain ones.
+inline cont_base* as_cont_base(cont_base& c)
+{
+    return &c;
+}
+
+template<class T>
+cont_base* as_cont_base(const shared_cont<T>& c)
+{
+    return &c.get();
+}
+
+// the handles that a task registered with cont_task_group::with() holds on the shared conts among its arguments.
+inline std::tuple<> shared_refs(cont_base&)
+{
+    return std::tuple<>();
+}
+
+template<class T>
+std::tuple<shared_cont<T>> shared_refs(const shared_cont<T>& c)
+{
+    return std::tuple<shared_cont<T>>(c);
+}
+
+// a closure along with the handles of the shared conts that its task waits for, which are released with the task, once it ran.
+template<class TaskFun, class Refs>
+struct holding_fun
+{
+    TaskFun fun;
+    Refs refs;
+
+    void operator()()
+    {
+        fun();
+    }
+};
+
+// the closure as it is when there are no shared conts to hold on to.
+template<class F>
+F&& hold_refs(F&& f, std::tuple<>)
+{
+    return std::forward<F>(f);
+}
+
+template<class F, class Refs>
+holding_fun<std::decay_t<F>, std::decay_t<Refs>> hold_refs(F&& f, Refs&& refs)
+{
+    return holding_fun<std::decay_t<F>, std::decay_t<Refs>>{ std::forward<F>(f), std::forward<Refs>(refs) };
+}
@@ -0,0 +1,395 @@
+// a thread-local slab allocator for the conts and cont_nodes of dynamic graphs.
+
+#pragma once
+
+#include "cont.h"
+
+#include <tbb/cache_aligned_allocator.h>
+
+#include <atomic>
+#include <array>
+#include <vector>
+#include <utility>
+#include <type_traits>
+#include <memory>
+#include <new>
+#include <algorithm>
+#include <mutex>
+#include <cstdlib>
+
+// an allocator for the conts (and cont_nodes) of dynamic graphs, which come and go too often for malloc.
+// every thread allocates from slabs of its own, split in a few size classes. an object freed by the thread it came from
+// goes straight back to that thread's free list. an object freed by another thread is held back until a batch of them
+// for the same thread has built up, and the whole batch is then handed back with a single compare-and-swap.
+// the owner takes all of its returned objects at once when one of its free lists runs dry.
+// a thread that exits hands back what it was still holding back for other threads first.
+// the slabs are only given back to the system when the allocator is destroyed, so it must outlive the objects it made.
+class slab_allocator
+{
+    static const int num_size_classes = 6;
+    static const size_t smallest_size = 32;
+    static const size_t slab_size = 16 * 1024;
+    static const int remote_batch_size = 32;
+
+    struct thread_cache;
+
+    // in front of every object, to tell where it goes back to.
+    struct alignas(std::max_align_t) header
+    {
+        thread_cache* owner;
+        int size_class;
+    };
+
+    struct free_block
+    {
+        free_block* next;
+    };
+
+    struct thread_cache
+    {
+        std::array<free_block*, num_size_classes> free_lists = {};
+        std::vector<void*> slabs;
+
+        // the remote frees of this thread that are waiting to go back to their owner, all of the same owner.
+        thread_cache* pending_owner = NULL;
+        free_block* pending_head = NULL;
+        free_block* pending_tail = NULL;
+        int pending_count = 0;
+
+        // the objects of this cache that other threads freed, on their own cache line since other threads write to it.
+        alignas(64) std::atomic<free_block*> returned;
+
+        thread_cache()
+            : returned(NULL)
+        { }
+
+        ~thread_cache()
+        {
+            for (void* slab : slabs)
+            {
+                std::free(slab);
+            }
+        }
+    };
+
+    // what the allocator shares with the threads that have a cache in it, so that a thread that exits after the allocator is gone
+    // knows not to touch its cache anymore.
+    struct shared_state
+    {
+        std::mutex mutex;
+        bool alive = true;
+        std::vector<thread_cache*> caches;
+    };
+
+    // the caches of the current thread, in all the allocators it used. when the thread exits, they hand back the remote frees
+    // they were still holding back, in the allocators that are still alive. the caches are found by the state of their allocator,
+    // which the thread keeps alive, so a new allocator can't be mistaken for one that's gone.
+    class thread_caches
+    {
+        struct entry
+        {
+            std::shared_ptr<shared_state> state;
+            thread_cache* cache;
+        };
+
+        std::vector<entry> _entries;
+
+    public:
+        thread_cache* find(const shared_state* state) const
+        {
+            for (size_t i = _entries.size(); i-- > 0; )
+            {
+                if (_entries[i].state.get() == state)
+                {
+                    return _entries[i].cache;
+                }
+            }
+            return NULL;
+        }
+
+        void add(const std::shared_ptr<shared_state>& state, thread_cache* cache)
+        {
+            // the allocators that are gone are forgotten on the way.
+            _entries.erase(std::remove_if(_entries.begin(), _entries.end(), [](const entry& e) {
+                std::lock_guard<std::mutex> lock(e.state->mutex);
+                return !e.state->alive;
+            }), _entries.end());
+
+            entry e;
+            e.state = state;
+            e.cache = cache;
+            _entries.push_back(e);
+        }
+
+        ~thread_caches()
+        {
+            for (entry& e : _entries)
+            {
+                std::lock_guard<std::mutex> lock(e.state->mutex);
+                if (e.state->alive)
+                {
+                    flush_pending(*e.cache);
+                }
+            }
+        }
+    };
+
+    static thread_caches& current_thread_caches()
+    {
+        static thread_local thread_caches caches;
+        return caches;
+    }
+
+    std::shared_ptr<shared_state> _state = std::make_shared<shared_state>();
+
+    thread_cache& local_cache()
+    {
+        thread_caches& caches = current_thread_caches();
+        if (thread_cache* cache = caches.find(_state.get()))
+        {
+            return *cache;
+        }
+
+        thread_cache* cache = new (tbb::cache_aligned_allocator<thread_cache>().allocate(1)) thread_cache();
+        {
+            std::lock_guard<std::mutex> lock(_state->mutex);
+            _state->caches.push_back(cache);
+        }
+        caches.add(_state, cache);
+        return *cache;
+    }
+
+    static int size_class_of(size_t size)
+    {
+        size_t class_size = smallest_size;
+        for (int c = 0; c < num_size_classes; c++)
+        {
+            if (size <= class_size)
+            {
+                return c;
+            }
+            class_size *= 2;
+        }
+        return -1;
+    }
+
+    static void refill(thread_cache& cache, int size_class)
+    {
+        size_t block_size = smallest_size << size_class;
+        char* slab = (char*)std::malloc(slab_size);
+        if (slab == NULL)
+        {
+            throw std::bad_alloc();
+        }
+        cache.slabs.push_back(slab);
+
+        free_block* head = NULL;
+        // linked from the back, so the free list hands the blocks out in address order.
+        for (size_t offset = slab_size; offset >= block_size; )
+        {
+            offset -= block_size;
+
+            header* h = (header*)(slab + offset);
+            h->owner = &cache;
+            h->size_class = size_class;
+
+            free_block* b = (free_block*)(h + 1);
+            b->next = head;
+            head = b;
+        }
+        cache.free_lists[size_class] = head;
+    }
+
+    static void take_returned(thread_cache& cache)
+    {
+        free_block* b = cache.returned.exchange(NULL, std::memory_order_acquire);
+        while (b != NULL)
+        {
+            free_block* next = b->next;
+            int size_class = ((header*)b - 1)->size_class;
+            b->next = cache.free_lists[size_class];
+            cache.free_lists[size_class] = b;
+            b = next;
+        }
+    }
+
+    static void flush_pending(thread_cache& cache)
+    {
+        if (cache.pending_head == NULL)
+        {
+            return;
+        }
+
+        std::atomic<free_block*>& returned = cache.pending_owner->returned;
+        cache.pending_tail->next = returned.load(std::memory_order_relaxed);
+        while (!returned.compare_exchange_weak(cache.pending_tail->next, cache.pending_head, std::memory_order_release, std::memory_order_relaxed))
+        { }
+
+        cache.pending_owner = NULL;
+        cache.pending_head = NULL;
+        cache.pending_tail = NULL;
+        cache.pending_count = 0;
+    }
+
+public:
+    slab_allocator() = default;
+
+    slab_allocator(const slab_allocator&) = delete;
+    slab_allocator& operator=(const slab_allocator&) = delete;
+
+    ~slab_allocator()
+    {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        _state->alive = false;
+        for (thread_cache* cache : _state->caches)
+        {
+            cache->~thread_cache();
+            tbb::cache_aligned_allocator<thread_cache>().deallocate(cache, 1);
+        }
+        _state->caches.clear();
+    }
+
+    void* allocate(size_t size)
+    {
+        int size_class = size_class_of(size + sizeof(header));
+        if (size_class < 0)
+        {
+            // too big for the slabs.
+            header* h = (header*)std::malloc(sizeof(header) + size);
+            if (h == NULL)
+            {
+                throw std::bad_alloc();
+            }
+            h->owner = NULL;
+            h->size_class = -1;
+            return h + 1;
+        }
+
+        thread_cache& cache = local_cache();
+        if (cache.free_lists[size_class] == NULL)
+        {
+            take_returned(cache);
+            if (cache.free_lists[size_class] == NULL)
+            {
+                refill(cache, size_class);
+            }
+        }
+
+        free_block* b = cache.free_lists[size_class];
+        cache.free_lists[size_class] = b->next;
+        return b;
+    }
+
+    void deallocate(void* p)
+    {
+        header* h = (header*)p - 1;
+        if (h->size_class < 0)
+        {
+            std::free(h);
+            return;
+        }
+
+        thread_cache& cache = local_cache();
+        free_block* b = (free_block*)p;
+
+        if (h->owner == &cache)
+        {
+            b->next = cache.free_lists[h->size_class];
+            cache.free_lists[h->size_class] = b;
+            return;
+        }
+
+        if (cache.pending_owner != h->owner)
+        {
+            flush_pending(cache);
+            cache.pending_owner = h->owner;
+            cache.pending_tail = b;
+        }
+
+        b->next = cache.pending_head;
+        cache.pending_head = b;
+
+        if (++cache.pending_count == remote_batch_size)
+        {
+            flush_pending(cache);
+        }
+    }
+
+    // hands the objects that the calling thread freed for other threads back right away, instead of once a batch is full.
+    void flush()
+    {
+        flush_pending(local_cache());
+    }
+
+    template<class T, class... Args>
+    T* make(Args&&... args)
+    {
+        static_assert(alignof(T) <= alignof(header), "the slabs only align objects like malloc does");
+
+        void* p = allocate(sizeof(T));
+        try
+        {
+            return new (p) T(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            deallocate(p);
+            throw;
+        }
+    }
+
+    template<class T>
+    void destroy(T* object)
+    {
+        object->~T();
+        deallocate(object);
+    }
+
+    template<class T>
+    cont<T>* make_cont()
+    {
+        return make<cont<T>>();
+    }
+};
+
+// the slab allocator that the conts of dynamic graphs and the cont_nodes of with_all come from by default.
+inline slab_allocator& cont_slabs()
+{
+    static slab_allocator slabs;
+    return slabs;
+}
+
+// a standard allocator on top of cont_slabs(), for containers of cont_nodes and the like.
+template<class T>
+struct slab_std_allocator
+{
+    typedef T value_type;
+
+    slab_std_allocator() = default;
+
+    template<class U>
+    slab_std_allocator(const slab_std_allocator<U>&)
+    { }
+
+    T* allocate(size_t n)
+    {
+        return (T*)cont_slabs().allocate(sizeof(T) * n);
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        cont_slabs().deallocate(p);
+    }
+
+    template<class U>
+    bool operator==(const slab_std_allocator<U>&) const
+    {
+        return true;
+    }
+
+    template<class U>
+    bool operator!=(const slab_std_allocator<U>&) const
+    {
+        return false;
+    }
+};
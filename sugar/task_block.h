@@ -0,0 +1,272 @@
+// task_block: a scope of tasks that define_task_block waits for, made of the same conts and counted tasks as cont_task_group.
+
+#pragma once
+
+#include "cont.h"
+#include "counted_task.h"
+#include "range_task.h"
+
+#include <tbb/task.h>
+#include <tbb/blocked_range.h>
+
+#include <cassert>
+#include <array>
+#include <memory>
+#include <utility>
+#include <type_traits>
+
+class task_block
+{
+    tbb::task* _self;
+
+    // if set, the tasks of the block are counted here instead of in _self's reference count.
+    completion_counter* _counter = NULL;
+
+    task_block(tbb::task* self)
+        : _self(self)
+    { }
+
+    template<class TaskFun, bool WaitForAll = false>
+    class task_runner : public counted_task
+    {
+        TaskFun mfun;
+
+    public:
+        template<class F>
+        explicit task_runner(F&& fun)
+            : mfun(std::forward<F>(fun))
+        { }
+
+        tbb::task* execute() override
+        {
+            // the extra reference has to be there before mfun() spawns anything,
+            // otherwise a quick child could bring the reference count to zero while this task is still running.
+            if (WaitForAll)
+            {
+                increment_ref_count();
+            }
+            mfun();
+            if (WaitForAll)
+            {
+                wait_for_all();
+            }
+            return NULL;
+        }
+    };
+
+    template<class TaskFun, int NumConts>
+    class cont_task_runner : public counted_task
+    {
+        TaskFun mfun;
+
+    public:
+        std::array<cont_base*, NumConts> conts;
+        std::array<cont_node, NumConts> nodes;
+
+        template<class F>
+        explicit cont_task_runner(F&& fun)
+            : mfun(std::forward<F>(fun))
+        { }
+
+        tbb::task* execute() override
+        {
+            mfun();
+            return NULL;
+        }
+    };
+
+public:
+    task_block(const task_block&) = delete;
+    task_block& operator=(const task_block&) = delete;
+    task_block* operator&() const = delete;
+
+    // allocates a task of this block, either as a child of the block's task or as a root task that's counted by the block's completion_counter.
+    template<class Task, class... Args>
+    Task& allocate_task(Args&&... args)
+    {
+        if (_counter == NULL)
+        {
+            return *new (_self->allocate_additional_child_of(*_self)) Task(std::forward<Args>(args)...);
+        }
+
+        Task& t = *new (tbb::task::allocate_root(*_self->group())) Task(std::forward<Args>(args)...);
+        t.count_in(*_counter);
+        return t;
+    }
+
+    // the closure is moved or copied straight into the task, so move-only closures work too.
+    template<class TaskFun>
+    void run(TaskFun&& tfun)
+    {
+        _self->spawn(allocate_task<task_runner<std::decay_t<TaskFun>>>(std::forward<TaskFun>(tfun)));
+    }
+
+    // runs tfun(i) for every i in [begin, end). the range is a single task of the block that splits itself over the workers,
+    // so it costs one reference of the block and one spawn from the calling thread instead of one of each for every index.
+    template<class TaskFun>
+    void run_range(int begin, int end, TaskFun&& tfun)
+    {
+        if (begin >= end)
+        {
+            return;
+        }
+
+        auto& t = allocate_task<range_root_task<std::decay_t<TaskFun>>>(std::forward<TaskFun>(tfun));
+        t.range = tbb::blocked_range<int>(begin, end, default_range_grainsize(begin, end));
+        _self->spawn(t);
+    }
+
+    // like run_range, but the result of tfun(i) is put in outs[i - begin], which is set ready right after.
+    template<class TaskFun, class R>
+    void run_range(int begin, int end, TaskFun&& tfun, cont<R>* outs)
+    {
+        run_range(begin, end, [fun = std::forward<TaskFun>(tfun), begin, outs](int i) {
+            cont<R>& out = outs[i - begin];
+            out.emplace(fun(i));
+            out.set_ready();
+        });
+    }
+
+    template<int NumConts>
+    class with_spawner
+    {
+        task_block* tb;
+        std::array<cont_base*, NumConts> conts;
+
+    public:
+        friend class task_block;
+
+        template<class TaskFun>
+        void run(TaskFun&& tfun)
+        {
+            auto& t = tb->allocate_task<cont_task_runner<std::decay_t<TaskFun>, NumConts>>(std::forward<TaskFun>(tfun));
+            t.conts = conts;
+            spawn_when_ready(t, t.conts.data(), t.nodes.data(), (int)t.conts.size());
+        }
+    };
+
+    template<class... Cont>
+    auto with(Cont&... conts)
+    {
+        with_spawner<sizeof...(conts)> spawner;
+        spawner.tb = this;
+        spawner.conts = { (&conts)... };
+        return spawner;
+    }
+
+    // the block's task always holds one extra reference while the block is open, which waiting consumes.
+    void wait()
+    {
+        _self->wait_for_all();
+        _self->increment_ref_count();
+    }
+
+    tbb::task& task()
+    {
+        return *_self;
+    }
+
+    template<class TBlockFun>
+    static void define_task_block(TBlockFun&& tbfun, completion_tracking tracking = completion_tracking::root_ref_count)
+    {
+        task_block tb(&tbb::task::self());
+
+        std::unique_ptr<completion_counter> counter;
+        if (tracking == completion_tracking::distributed)
+        {
+            counter.reset(new completion_counter(tb._self));
+            tb._counter = counter.get();
+        }
+
+        tb._self->increment_ref_count();
+        tbfun(tb);
+        tb._self->wait_for_all();
+    }
+
+    template<class TBlockFun>
+    static void define_root_task_block(TBlockFun&& tbfun, completion_tracking tracking = completion_tracking::root_ref_count)
+    {
+        task_block tb(0);
+        auto task_fun = [&] { tbfun(tb); };
+        tb._self = new (tbb::task::allocate_root()) task_runner<decltype(task_fun), true>(task_fun);
+
+        std::unique_ptr<completion_counter> counter;
+        if (tracking == completion_tracking::distributed)
+        {
+            counter.reset(new completion_counter(tb._self));
+            tb._counter = counter.get();
+        }
+
+        tbb::task::spawn_root_and_wait(*tb._self);
+    }
+
+    // like define_task_block, but without waiting: the current task gets a continuation that runs thenfun once all the tasks of the block
+    // have finished, and the current task must return right after this call, without touching the block's state.
+    // so the worker is free to steal other work instead of sitting in wait_for_all(), and nested blocks don't pile up on its stack.
+    // the current task has to be waited for through its parent, or be a counted_task that is counted by a completion_counter,
+    // since that's what the continuation takes over. a second call from the same task finds neither, so it's caught by the assert.
+    // if tbfun throws, the group is cancelled, so that the tasks of the block that haven't started yet and thenfun are skipped,
+    // and the exception goes on to the current task, which hands it over to whoever waits for the group.
+    template<class TBlockFun, class ThenFun>
+    static void define_task_block_then(TBlockFun&& tbfun, ThenFun&& thenfun)
+    {
+        tbb::task& self = tbb::task::self();
+        counted_task* counted = dynamic_cast<counted_task*>(&self);
+        assert(self.parent() != NULL || (counted != NULL && counted->is_counted()));
+
+        // the continuation takes over the parent of the current task, so whoever waits for the current task now waits for thenfun.
+        auto& k = *new (self.allocate_continuation()) task_runner<std::decay_t<ThenFun>>(std::forward<ThenFun>(thenfun));
+
+        // same for a task that is counted by a completion_counter instead of its parent.
+        if (counted != NULL)
+        {
+            counted->hand_over_count(k);
+        }
+
+        // the extra reference keeps the continuation from running while tbfun is still spawning.
+        k.set_ref_count(1);
+
+        task_block tb(&k);
+        try
+        {
+            tbfun(tb);
+        }
+        catch (...)
+        {
+            // nothing would ever drop the extra reference otherwise, and whoever waits for the group would wait forever.
+            self.cancel_group_execution();
+            if (k.decrement_ref_count() == 0)
+            {
+                tbb::task::spawn(k);
+            }
+            throw;
+        }
+
+        if (k.decrement_ref_count() == 0)
+        {
+            tbb::task::spawn(k);
+        }
+    }
+};
+
+// with completion_tracking::distributed, the tasks of the block are counted with a completion_counter instead of the reference count
+// of the block's task, which scales better for blocks that spawn huge numbers of small tasks from many threads.
+template<class TBlockFun>
+void define_task_block(TBlockFun tbfun, completion_tracking tracking = completion_tracking::root_ref_count)
+{
+    task_block::define_task_block(tbfun, tracking);
+}
+
+template<class TBlockFun>
+void define_root_task_block(TBlockFun tbfun, completion_tracking tracking = completion_tracking::root_ref_count)
+{
+    task_block::define_root_task_block(tbfun, tracking);
+}
+
+// the code after the block goes in thenfun, which runs as a continuation of the current task instead of blocking it.
+// the tasks of the block can outlive the calling function's stack frame, so they shouldn't capture its locals by reference.
+template<class TBlockFun, class ThenFun>
+void define_task_block_then(TBlockFun tbfun, ThenFun thenfun)
+{
+    task_block::define_task_block_then(tbfun, std::move(thenfun));
+}
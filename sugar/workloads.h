@@ -0,0 +1,137 @@
+// the graphs and the busy work that the checks and the benchmarks have in common.
+
+#pragma once
+
+#include "cont_task_group.h"
+
+#include <tbb/tick_count.h>
+
+#include <atomic>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+// spins for about the given number of microseconds, to stand for the work of a task.
+inline void SpinFor(double microseconds)
+{
+    tbb::tick_count start = tbb::tick_count::now();
+    while ((tbb::tick_count::now() - start).seconds() * 1e6 < microseconds)
+    { }
+}
+
+// the tasks of one frame of a small graph: every part is computed from the frame number, and a last task sums the parts up.
+// the closures only hold references, so the same tasks work for every frame when they're captured once and replayed.
+inline void AddFrameTasks(cont_task_group& g, const int& frame, std::vector<cont<int>>& parts, std::vector<cont_base*>& inputs, cont<long long>& total)
+{
+    for (int i = 0; i < (int)parts.size(); i++)
+    {
+        g.run([&frame, &parts, i] {
+            parts[i].emplace(frame + i);
+            parts[i].set_ready();
+        });
+    }
+
+    g.with_all(inputs.data(), (int)inputs.size()).run([&parts, &total] {
+        long long sum = 0;
+        for (cont<int>& part : parts)
+        {
+            sum += *part;
+        }
+        total.emplace(sum);
+        total.set_ready();
+    });
+}
+
+// what the total of AddFrameTasks comes to for the given frame.
+inline long long FrameTotal(int frame, int num_parts)
+{
+    return (long long)num_parts * frame + (long long)num_parts * (num_parts - 1) / 2;
+}
+
+// a graph of depth layers of width tasks, where every task adds up two values of the layer before it.
+inline void AddLayeredTasks(cont_task_group& g, std::vector<cont<int>>& values, int width, int depth)
+{
+    for (int i = 0; i < width; i++)
+    {
+        g.run([&values, i] {
+            values[i].emplace(i);
+            values[i].set_ready();
+        });
+    }
+
+    for (int layer = 1; layer < depth; layer++)
+    {
+        for (int i = 0; i < width; i++)
+        {
+            cont<int>& left = values[(layer - 1) * width + i];
+            cont<int>& right = values[(layer - 1) * width + (i + 1) % width];
+            cont<int>& out = values[layer * width + i];
+            g.with(left, right).run([&left, &right, &out] {
+                out.emplace((*left + *right) % 1000003);
+                out.set_ready();
+            });
+        }
+    }
+
+    for (int i = 0; i < width; i++)
+    {
+        g.capture_output(values[(depth - 1) * width + i]);
+    }
+}
+
+inline long long LastLayerSum(std::vector<cont<int>>& values, int width)
+{
+    long long sum = 0;
+    for (size_t i = values.size() - width; i < values.size(); i++)
+    {
+        sum += *values[i];
+    }
+    return sum;
+}
+
+// what LastLayerSum gives for the graph of AddLayeredTasks, worked out without any tasks.
+inline long long LayeredSum(int width, int depth)
+{
+    std::vector<int> layer(width), next(width);
+    for (int i = 0; i < width; i++)
+    {
+        layer[i] = i;
+    }
+    for (int d = 1; d < depth; d++)
+    {
+        for (int i = 0; i < width; i++)
+        {
+            next[i] = (layer[i] + layer[(i + 1) % width]) % 1000003;
+        }
+        layer.swap(next);
+    }
+
+    long long sum = 0;
+    for (int x : layer)
+    {
+        sum += x;
+    }
+    return sum;
+}
+
+// how many CPUs the current thread is allowed to run on, or 0 where that isn't known.
+inline int AllowedCpuCount()
+{
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        return CPU_COUNT(&set);
+    }
+#endif
+    return 0;
+}
+
+inline void RecordMax(std::atomic<int>& max, int value)
+{
+    int current = max.load();
+    while (value > current && !max.compare_exchange_weak(current, value))
+    { }
+}